@@ -0,0 +1,225 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <type_traits>
+using namespace std;
+
+
+namespace tsp
+{
+    
+    /* Writes a value in binary form. */
+    template<class V>
+    void write_binary(ostream& os, const V& value)
+    {
+        static_assert(is_trivially_copyable<V>::value, "V");
+        os.write(reinterpret_cast<const char*>(&value), sizeof(V));
+    }
+    
+    
+    /* Writes a list of values in binary form, preceded by its size. */
+    template<class V>
+    void write_binary(ostream& os, const vector<V>& values)
+    {
+        static_assert(is_trivially_copyable<V>::value, "V");
+        write_binary(os, (uint64_t)values.size());
+        os.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(V));
+    }
+    
+    
+    /* Writes a string in binary form, preceded by its size. */
+    inline void write_binary(ostream& os, const string& str)
+    {
+        write_binary(os, (uint64_t)str.size());
+        os.write(str.data(), str.size());
+    }
+    
+    
+    /* Reads a value written in binary form. */
+    template<class V>
+    void read_binary(istream& is, V& value)
+    {
+        static_assert(is_trivially_copyable<V>::value, "V");
+        
+        if (!is.read(reinterpret_cast<char*>(&value), sizeof(V)))
+            throw invalid_argument("snapshot");
+    }
+    
+    
+    /* Reads a list of values written in binary form. */
+    template<class V>
+    void read_binary(istream& is, vector<V>& values)
+    {
+        uint64_t size;
+        read_binary(is, size);
+        values.resize(size);
+        
+        if (!is.read(reinterpret_cast<char*>(values.data()), size * sizeof(V)))
+            throw invalid_argument("snapshot");
+    }
+    
+    
+    /* Reads a string written in binary form. */
+    inline void read_binary(istream& is, string& str)
+    {
+        uint64_t size;
+        read_binary(is, size);
+        str.resize(size);
+        
+        if (!is.read(&str[0], size))
+            throw invalid_argument("snapshot");
+    }
+    
+    
+    /* Writes the snapshots of the solver state to a file on a background thread.
+     * Only the most recent snapshot is written if the previous one is still pending. */
+    struct Checkpoint
+    {
+        /* Constructor. */
+        explicit Checkpoint(const string& filename)
+        : filename(filename),
+        pending(false),
+        writing(false),
+        failure(false),
+        stop(false),
+        writer(&Checkpoint::run, this)
+        {
+        }
+        
+        
+        /* Writes the last snapshot and waits for the background thread. */
+        ~Checkpoint()
+        {
+            {
+                lock_guard<mutex> lock(m);
+                stop = true;
+            }
+            
+            cv.notify_all();
+            writer.join();
+        }
+        
+        
+        /* Queues a snapshot to be written (a failed write does not stop the following ones). */
+        void post(string snapshot)
+        {
+            lock_guard<mutex> lock(m);
+            data = move(snapshot);
+            pending = true;
+            cv.notify_all();
+        }
+        
+        
+        /* Waits until the queued snapshots are written. */
+        void flush()
+        {
+            unique_lock<mutex> lock(m);
+            cv.wait(lock, [this] { return !pending && !writing; });
+        }
+        
+        
+        /* Whether the last write failed. */
+        bool failed()
+        {
+            lock_guard<mutex> lock(m);
+            return failure;
+        }
+    
+    
+    private:
+        
+        
+        /* Background thread. */
+        void run()
+        {
+            unique_lock<mutex> lock(m);
+            
+            while (true)
+            {
+                cv.wait(lock, [this] { return pending || stop; });
+                
+                if (!pending)
+                    break;
+                
+                auto snapshot = move(data);
+                pending = false;
+                writing = true;
+                
+                // the solver can post new snapshots while this one is written
+                lock.unlock();
+                auto written = true;
+                
+                try
+                {
+                    write(snapshot);
+                }
+                catch (...)
+                {
+                    written = false;
+                }
+                
+                lock.lock();
+                failure = !written;
+                writing = false;
+                cv.notify_all();
+            }
+        }
+        
+        
+        /* Replaces the file with the snapshot (a partial write never overwrites the previous one). */
+        void write(const string& snapshot) const
+        {
+            const auto tmp = filename + ".tmp";
+            
+            {
+                ofstream ostream(tmp, ios::binary | ios::trunc);
+                
+                if (!ostream.write(snapshot.data(), snapshot.size()))
+                    throw invalid_argument(tmp);
+            }
+            
+            if (rename(tmp.c_str(), filename.c_str()) != 0)
+                throw invalid_argument(filename);
+        }
+        
+        
+        
+        // snapshot file
+        const string filename;
+        
+        // last snapshot not written yet
+        string data;
+        
+        // whether data has to be written
+        bool pending;
+        
+        // whether a snapshot is being written
+        bool writing;
+        
+        // whether the last write failed
+        bool failure;
+        
+        // whether the background thread has to exit
+        bool stop;
+        
+        mutex m;
+        condition_variable cv;
+        
+        // background thread
+        thread writer;
+    };
+    
+}
+
+
+#endif
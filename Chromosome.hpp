@@ -12,12 +12,12 @@ using namespace std;
 
 namespace tsp
 {
-    template<class T>
+    template<class T, class I = unsigned>
     struct Chromosome
     {
         /* Constructor. */
         explicit Chromosome(size_t size)
-        : cost(T())
+        : cost(cost_type<T>())
         {
             tour.resize(size);
         }
@@ -26,36 +26,36 @@ namespace tsp
         /* Constructs a new chromosome with a random tour. */
         template<class G>
         explicit Chromosome(const vector<vector<T>>& distances, G& engine,
-                            const vector<vector<unsigned>>& nearest)
+                            const vector<vector<I>>& nearest)
         {
             const auto size = distances[0].size();
             tour.resize(size);
             
-            for (unsigned i = 0; i < size; i++)
-                tour[i] = i;
+            for (size_t i = 0; i < size; i++)
+                tour[i] = (I)i;
             
             shuffle(tour.begin(), tour.end(), engine);
             opt2(distances, nearest);
         }
         
         /* Constructor. */
-        explicit Chromosome(const vector<unsigned>& tour,
+        explicit Chromosome(const vector<I>& tour,
                             const vector<vector<T>>& distances,
-                            const vector<vector<unsigned>>& nearest)
+                            const vector<vector<I>>& nearest)
         : tour(tour)
         {
             opt2(distances, nearest);
         }
         
         /* Constructor. */
-        explicit Chromosome(const vector<unsigned>& tour, T cost)
+        explicit Chromosome(const vector<I>& tour, cost_type<T> cost)
         : tour(tour), cost(cost)
         {
         }
         
         
         void opt2(const vector<vector<T>>& distances,
-                  const vector<vector<unsigned>>& nearest)
+                  const vector<vector<I>>& nearest)
         {
             // optimize the tour
             cost = tsp::opt2(tour, distances);
@@ -67,8 +67,8 @@ namespace tsp
         }
         
         
-        vector<unsigned> tour;
-        T cost;
+        vector<I> tour;
+        cost_type<T> cost;
     };
 }
 
@@ -0,0 +1,376 @@
+#ifndef DECOMPOSITION_HPP
+#define DECOMPOSITION_HPP
+
+
+#include "GTSP.hpp"
+#include "TSP.hpp"
+
+#include <vector>
+#include <utility>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+using namespace chrono;
+
+
+
+namespace tsp
+{
+    /* Solves huge instances partitioning the nodes into spatial clusters, each one solved
+     * by an independent GTSP on its own thread. The sub-tours are stitched into a global
+     * tour, which is then improved re-solving overlapping windows of it in parallel.
+     * The sub-problems are solved with nodes indexed by I. */
+    template<class T, class I = unsigned>
+    struct Decomposition
+    {
+        /* Constrcts the object with a TSPLIB file. */
+        explicit Decomposition(const string& filename)
+        : Decomposition(TSP::parse_tsplib(filename))
+        {
+        }
+        
+        /* Constructs the object with a list of node coordinates. */
+        explicit Decomposition(const vector<pair<double, double>>& coordinates,
+                               size_t cluster_size = 100,
+                               unsigned threads = thread::hardware_concurrency())
+        : coordinates(coordinates),
+        cluster_size(cluster_size),
+        threads(max(threads, 1u)),
+        windows_time(0.5),
+        windows_passes(2)
+        {
+            if (coordinates.empty())
+                throw invalid_argument("coordinates");
+            
+            if (cluster_size < 16 || cluster_size > (size_t)numeric_limits<I>::max() + 1)
+                throw invalid_argument("cluster_size");
+        }
+        
+        
+        /* Solves the TSP problem within the given time [s]. */
+        Chromosome<T> solve(double timeout)
+        {
+            const auto size = coordinates.size();
+            const auto finished = deadline(timeout);
+            
+            // small instances do not need to be decomposed
+            if (size <= cluster_size)
+            {
+                GTSP<T, I> gtsp(coordinates);
+                auto stop = deadline(timeout);
+                const auto best = gtsp.solve(stop);
+                
+                return Chromosome<T>(vector<unsigned>(best.tour.begin(), best.tour.end()), best.cost);
+            }
+            
+            // solve each cluster in its share of the first part of the time
+            const auto clusters = partition();
+            const auto cluster_share = min(1.0, double(threads) / clusters.size());
+            const auto cluster_time = timeout * (1 - windows_time) * cluster_share;
+            vector<vector<unsigned>> subtours(clusters.size());
+            
+            parallel_for(clusters.size(), [&](size_t i)
+            {
+                subtours[i] = solve_cluster(clusters[i], cluster_time);
+            });
+            
+            auto tour = stitch(subtours);
+            
+            // re-solve the windows: each pass is made of two phases, where the windows of the
+            // second one overlap the boundaries of the windows of the first one
+            const auto windows = size / cluster_size;
+            const auto window_share = min(1.0, double(threads) / windows);
+            const auto window_time = timeout * windows_time / (2 * windows_passes) * window_share;
+            
+            for (unsigned pass = 0; pass < windows_passes; pass++)
+            {
+                for (size_t offset : { size_t(0), cluster_size / 2 })
+                {
+                    // windows of the same phase are disjoint and can be solved in parallel
+                    parallel_for(windows, [&](size_t i)
+                    {
+                        const auto from = offset + i * cluster_size;
+                        
+                        // the windows are improvements: they are skipped once the time is over
+                        if (from + cluster_size <= size && !finished())
+                            solve_window(tour, from, from + cluster_size, window_time);
+                    });
+                }
+                
+                // move the boundaries of the tour, so that the next pass re-solves its seam
+                rotate(tour.begin(), tour.begin() + cluster_size / 4, tour.end());
+            }
+            
+            return Chromosome<T>(tour, cost(tour));
+        }
+    
+    
+    
+    
+    private:
+        
+        
+        /* Partitions the nodes into a grid of cells with (about) the same number of nodes:
+         * the nodes are split into vertical strips, then each strip into cells. The cells
+         * are listed according to a boustrophedon path. */
+        vector<vector<unsigned>> partition() const
+        {
+            const auto size = coordinates.size();
+            const auto cells = (size + cluster_size - 1) / cluster_size;
+            const auto strips = max<size_t>(1, (size_t)round(sqrt((double)cells)));
+            
+            vector<unsigned> nodes(size);
+            iota(nodes.begin(), nodes.end(), 0);
+            
+            sort(nodes.begin(), nodes.end(), [this](unsigned i, unsigned j)
+                 { return coordinates[i].first < coordinates[j].first; });
+            
+            vector<vector<unsigned>> clusters;
+            
+            for (size_t s = 0; s < strips; s++)
+            {
+                const auto first = nodes.begin() + s * size / strips;
+                const auto last = nodes.begin() + (s + 1) * size / strips;
+                
+                // alternate the direction of the strips
+                sort(first, last, [this, s](unsigned i, unsigned j)
+                {
+                    return s % 2 == 0 ? coordinates[i].second < coordinates[j].second
+                                      : coordinates[i].second > coordinates[j].second;
+                });
+                
+                const size_t len = last - first;
+                const auto n = (len + cluster_size - 1) / cluster_size;
+                
+                for (size_t c = 0; c < n; c++)
+                    clusters.emplace_back(first + c * len / n, first + (c + 1) * len / n);
+            }
+            
+            return clusters;
+        }
+        
+        
+        /* Solves the sub-problem of a cluster and returns its tour (of global node indices). */
+        vector<unsigned> solve_cluster(const vector<unsigned>& cluster, double timeout) const
+        {
+            vector<pair<double, double>> sub(cluster.size());
+            
+            for (size_t i = 0; i < cluster.size(); i++)
+                sub[i] = coordinates[cluster[i]];
+            
+            GTSP<T, I> gtsp(sub);
+            auto stop = deadline(timeout);
+            const auto best = gtsp.solve(stop);
+            vector<unsigned> tour(best.tour.size());
+            
+            for (size_t i = 0; i < tour.size(); i++)
+                tour[i] = cluster[best.tour[i]];
+            
+            return tour;
+        }
+        
+        
+        /* Re-solves the path of the tour between the positions [from, to), whose ends are fixed:
+         * the sub-problem is a cycle where the edge between the two ends has length 0. */
+        void solve_window(vector<unsigned>& tour, size_t from, size_t to, double timeout) const
+        {
+            const auto len = to - from;
+            vector<pair<double, double>> sub(len);
+            
+            for (size_t i = 0; i < len; i++)
+                sub[i] = coordinates[tour[from + i]];
+            
+            auto matrix = TSP::distances<T>(sub);
+            
+            // cost of the current path
+            cost_type<T> current = 0;
+            
+            for (size_t i = 0; i < len - 1; i++)
+                current += matrix[i][i + 1];
+            
+            matrix[0][len - 1] = matrix[len - 1][0] = 0;
+            
+            GTSP<T, I> gtsp(sub, move(matrix));
+            auto stop = deadline(timeout);
+            const auto best = gtsp.solve(stop);
+            
+            if (!(best.cost < current))
+                return;
+            
+            // the cycle has to contain the edge between the ends of the path
+            const auto& cycle = best.tour;
+            const auto p = find(cycle.begin(), cycle.end(), I(0)) - cycle.begin();
+            const auto next = cycle[(p + 1) % len];
+            const auto prev = cycle[(p + len - 1) % len];
+            
+            if (next != len - 1 && prev != len - 1)
+                return;
+            
+            // walk the cycle from the first end away from the last one
+            const auto step = (next == len - 1) ? len - 1 : 1;
+            vector<unsigned> path(len);
+            
+            for (size_t i = 0, j = p; i < len; i++, j = (j + step) % len)
+                path[i] = tour[from + cycle[j]];
+            
+            copy(path.begin(), path.end(), tour.begin() + from);
+        }
+        
+        
+        /* Joins the sub-tours of the clusters (listed in order) into a global tour: each sub-tour
+         * is entered at its node closest to the exit of the previous one, and it is left in the
+         * direction that brings closer to the next cluster. */
+        vector<unsigned> stitch(const vector<vector<unsigned>>& subtours) const
+        {
+            const auto count = subtours.size();
+            vector<pair<double, double>> centroids(count);
+            
+            for (size_t i = 0; i < count; i++)
+            {
+                for (auto node : subtours[i])
+                {
+                    centroids[i].first += coordinates[node].first / subtours[i].size();
+                    centroids[i].second += coordinates[node].second / subtours[i].size();
+                }
+            }
+            
+            vector<unsigned> tour;
+            tour.reserve(coordinates.size());
+            
+            // the tour is closed: the first cluster is entered from the last one
+            auto exit = centroids.back();
+            
+            for (size_t i = 0; i < count; i++)
+            {
+                const auto& subtour = subtours[i];
+                const auto len = subtour.size();
+                const auto& target = centroids[(i + 1) % count];
+                
+                // the node closest to the exit of the previous cluster
+                size_t entry = 0;
+                auto best = numeric_limits<double>::max();
+                
+                for (size_t j = 0; j < len; j++)
+                {
+                    const auto d = distance(coordinates[subtour[j]], exit);
+                    
+                    if (d < best)
+                    {
+                        best = d;
+                        entry = j;
+                    }
+                }
+                
+                // the last node is one of the two neighbors of the entry
+                const auto forward = distance(coordinates[subtour[(entry + len - 1) % len]], target)
+                    <= distance(coordinates[subtour[(entry + 1) % len]], target);
+                
+                for (size_t k = 0, j = entry; k < len; k++)
+                {
+                    tour.push_back(subtour[j]);
+                    j = forward ? (j + 1) % len : (j + len - 1) % len;
+                }
+                
+                exit = coordinates[tour.back()];
+            }
+            
+            return tour;
+        }
+        
+        
+        /* Gets the cost of a tour (without the matrix of distances). */
+        cost_type<T> cost(const vector<unsigned>& tour) const
+        {
+            cost_type<T> dist = 0;
+            const auto len = tour.size();
+            
+            for (size_t i = 0; i < len; i++)
+                dist += (T)TSP::norm(coordinates[tour[i]], coordinates[tour[(i + 1) % len]]);
+            
+            return dist;
+        }
+        
+        
+        /* Euclidean distance (not rounded). */
+        static double distance(const pair<double, double>& p1, const pair<double, double>& p2)
+        {
+            return hypot(p1.first - p2.first, p1.second - p2.second);
+        }
+        
+        
+        /* Gets a stop criteria that is met after the given time [s]. */
+        static function<bool()> deadline(double timeout)
+        {
+            const auto end = steady_clock::now() + duration_cast<steady_clock::duration>(duration<double>(timeout));
+            return [end] { return steady_clock::now() >= end; };
+        }
+        
+        
+        /* Calls f(i) for i in [0, count) on the available threads. */
+        template<class F>
+        void parallel_for(size_t count, F f) const
+        {
+            atomic<size_t> next(0);
+            exception_ptr error;
+            mutex m;
+            vector<thread> pool;
+            
+            for (unsigned t = 0; t < min<size_t>(threads, count); t++)
+            {
+                pool.emplace_back([&]
+                {
+                    for (size_t i; (i = next++) < count; )
+                    {
+                        try
+                        {
+                            f(i);
+                        }
+                        catch (...)
+                        {
+                            lock_guard<mutex> lock(m);
+                            error = current_exception();
+                        }
+                    }
+                });
+            }
+            
+            for (auto& t : pool)
+                t.join();
+            
+            if (error)
+                rethrow_exception(error);
+        }
+        
+        
+        
+        
+        // nodes coordinates
+        const vector<pair<double, double>> coordinates;
+        
+        // (maximum) number of nodes of each cluster and of each window
+        const size_t cluster_size;
+        
+        // number of threads
+        const unsigned threads;
+        
+        // fraction of the time spent re-solving the windows of the global tour
+        const double windows_time;
+        
+        // number of times each window is re-solved
+        const unsigned windows_passes;
+    };
+}
+
+
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef EDGE_FREQUENCY_HPP
+#define EDGE_FREQUENCY_HPP
+
+
+#include "Checkpoint.hpp"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+
+namespace tsp
+{
+    /* Number of individuals of the population that share each (undirected) edge.
+     * The diversity metrics are updated in constant time for each changed edge. */
+    struct EdgeFrequency
+    {
+        /* Constructor. */
+        EdgeFrequency()
+        : individuals(0), nodes(0), sum_flogf(0), shared_pairs(0)
+        {
+        }
+        
+        
+        /* Adds the edges of a tour. */
+        template<class I>
+        void add(const vector<I>& tour)
+        {
+            nodes = tour.size();
+            individuals++;
+            
+            for_each_edge(tour, [this](uint64_t e)
+            {
+                auto& f = frequency[e];
+                update(f, f + 1);
+                f++;
+            });
+        }
+        
+        
+        /* Removes the edges of a tour. */
+        template<class I>
+        void remove(const vector<I>& tour)
+        {
+            individuals--;
+            
+            for_each_edge(tour, [this](uint64_t e)
+            {
+                const auto it = frequency.find(e);
+                update(it->second, it->second - 1);
+                
+                if (--it->second == 0)
+                    frequency.erase(it);
+            });
+        }
+        
+        
+        /* Removes all the edges. */
+        void clear()
+        {
+            frequency.clear();
+            individuals = 0;
+            sum_flogf = 0;
+            shared_pairs = 0;
+        }
+        
+        
+        /* Gets the number of tours that contain the edge (i, j). */
+        unsigned count(unsigned i, unsigned j) const
+        {
+            const auto it = frequency.find(key(i, j));
+            return it == frequency.end() ? 0 : it->second;
+        }
+        
+        
+        /* Gets the edge entropy of the population, normalized in [0, 1]:
+         * 0 when all the tours are equal, 1 when they do not share any edge. */
+        double entropy() const
+        {
+            if (individuals < 2 || nodes == 0)
+                return 0;
+            
+            const auto p = (double)individuals;
+            // H = -sum(f/p * log(f/p)) = n * log(p) - sum(f * log(f)) / p
+            const auto h = nodes * log(p) - sum_flogf / p;
+            
+            return max(0.0, h / (nodes * log(p)));
+        }
+        
+        
+        /* Gets the mean number of different edges between two tours of the population,
+         * normalized in [0, 1] by the number of nodes. */
+        double distance() const
+        {
+            if (individuals < 2 || nodes == 0)
+                return 0;
+            
+            const auto pairs = individuals * (individuals - 1) / 2.0;
+            return max(0.0, 1 - shared_pairs / pairs / nodes);
+        }
+        
+        
+        /* Writes the table in binary form. */
+        void write(ostream& os) const
+        {
+            write_binary(os, (uint64_t)individuals);
+            write_binary(os, (uint64_t)nodes);
+            write_binary(os, sum_flogf);
+            write_binary(os, shared_pairs);
+            
+            vector<uint64_t> keys;
+            vector<unsigned> counts;
+            keys.reserve(frequency.size());
+            counts.reserve(frequency.size());
+            
+            for (const auto& e : frequency)
+            {
+                keys.push_back(e.first);
+                counts.push_back(e.second);
+            }
+            
+            write_binary(os, keys);
+            write_binary(os, counts);
+        }
+        
+        
+        /* Reads a table written in binary form. */
+        void read(istream& is)
+        {
+            uint64_t n;
+            read_binary(is, n);
+            individuals = n;
+            read_binary(is, n);
+            nodes = n;
+            read_binary(is, sum_flogf);
+            read_binary(is, shared_pairs);
+            
+            vector<uint64_t> keys;
+            vector<unsigned> counts;
+            read_binary(is, keys);
+            read_binary(is, counts);
+            
+            if (keys.size() != counts.size())
+                throw invalid_argument("snapshot");
+            
+            frequency.clear();
+            
+            for (size_t i = 0; i < keys.size(); i++)
+                frequency[keys[i]] = counts[i];
+        }
+    
+    
+    private:
+        
+        
+        /* Updates the metrics when the frequency of an edge changes. */
+        void update(unsigned from, unsigned to)
+        {
+            sum_flogf += flogf(to) - flogf(from);
+            shared_pairs += (double(to) * (to - 1) - double(from) * (from - 1)) / 2;
+        }
+        
+        
+        static double flogf(unsigned f)
+        {
+            return f == 0 ? 0 : f * log((double)f);
+        }
+        
+        
+        static uint64_t key(unsigned i, unsigned j)
+        {
+            return (uint64_t)min(i, j) << 32 | max(i, j);
+        }
+        
+        
+        template<class I, class F>
+        static void for_each_edge(const vector<I>& tour, F f)
+        {
+            const auto len = tour.size();
+            
+            for (size_t i = 0; i < len; i++)
+                f(key(tour[i], tour[(i + 1) % len]));
+        }
+        
+        
+        
+        // number of tours sharing each edge
+        unordered_map<uint64_t, unsigned> frequency;
+        
+        // number of tours
+        size_t individuals;
+        
+        // number of edges of each tour
+        size_t nodes;
+        
+        // sum of f * log(f) over the edges (entropy)
+        double sum_flogf;
+        
+        // number of pairs of tours sharing an edge summed over the edges (distance)
+        double shared_pairs;
+    };
+}
+
+
+#endif
@@ -3,10 +3,19 @@
 
 
 #include "Chromosome.hpp"
+#include "Checkpoint.hpp"
+#include "EdgeFrequency.hpp"
+#include "LowerBound.hpp"
+#include "Island.hpp"
 #include "Heuristic.hpp"
 #include "TSP.hpp"
 
 #include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <cstdint>
 #include <utility>
 #include <chrono>
 #include <random>
@@ -14,6 +23,8 @@
 #include <functional>
 #include <cmath>
 #include <cassert>
+#include <limits>
+#include <stdexcept>
 using namespace std;
 using namespace chrono;
 
@@ -21,7 +32,27 @@ using namespace chrono;
 
 namespace tsp
 {
-    template<class T>
+    /* Ways of rebuilding the population after an extinction. */
+    enum class Refill
+    {
+        // new tours built by the constructor of each slot
+        Construction,
+        // kicks applied to the survivors (iterated local search)
+        IteratedLocalSearch
+    };
+    
+    
+    /* Operators used to mate the parents. */
+    enum class Crossover
+    {
+        // order crossover followed by 2-opt
+        Order,
+        // partition crossover (GPX), falling back to the order crossover
+        Partition
+    };
+    
+    
+    template<class T, class I = unsigned>
     struct GTSP
     {
         /* Constrcts the object with a TSPLIB file. */
@@ -32,49 +63,448 @@ namespace tsp
         
         /* Constructs the object with a list of node coordinates. */
         explicit GTSP(const vector<pair<double, double>>& coordinates)
+        : GTSP(coordinates, TSP::distances<T>(coordinates))
+        {
+        }
+        
+        /* Constructs the object with a list of node coordinates and the matrix of
+         * distances between them (which may differ from the euclidean ones). */
+        explicit GTSP(const vector<pair<double, double>>& coordinates, vector<vector<T>> matrix)
         : coordinates(coordinates),
         psize(coordinates.size()),
-        distances(TSP::distances<T>(coordinates)),
+        distances(move(matrix)),
         minp(5),
         maxp(max_population()),
         engine((unsigned)system_clock::now().time_since_epoch().count()),
-        mprob(0.2),
+        base_mprob(0.2),
+        mprob(base_mprob),
         not_improving_gen(0),
         max_not_improving_gen(50),
-        massacre_percentage(0.5f)
+        massacre_percentage(0.5f),
+        max_massacre_percentage(0.9),
+        max_convergence(0.25),
+        min_different_edges(2),
+        reference_diversity(0),
+        constructors({ Construction::NearestNeighbor, Construction::GreedyEdge,
+            Construction::SpaceFillingCurve, Construction::RandomGreedyEdge,
+            Construction::RandomNearestNeighbor }),
+        refill(Refill::IteratedLocalSearch),
+        crossover_type(Crossover::Partition),
+        checkpoint_interval(0),
+        checkpoint_failure(false),
+        resumed(false),
+        target_gap(0),
+        bound(0),
+        bound_converged(false),
+        island(nullptr),
+        migration_interval(0)
         {
+            if (distances.size() != psize)
+                throw invalid_argument("matrix");
+            
+            // the nodes have to be indexed by I
+            if (psize > (size_t)numeric_limits<I>::max() + 1)
+                throw invalid_argument("coordinates");
+            
             nearest.resize(psize);
             
             for (unsigned i = 0; i != psize; i++)
+                sort_nearest(i);
+        }
+        
+        
+        /* Adds a node to the instance and returns its index (its distances have to fit T).
+         * The tours of the population are repaired by cheapest insertion. */
+        unsigned add_node(const pair<double, double>& node)
+        {
+            if (psize > (size_t)numeric_limits<I>::max() || !fits(node, psize))
+                throw invalid_argument("node");
+            
+            const auto idx = (unsigned)psize;
+            coordinates.push_back(node);
+            psize++;
+            
+            // extend the matrix of distances with the new row and column
+            distances.emplace_back(psize);
+            
+            for (unsigned i = 0; i != idx; i++)
             {
-                nearest[i].resize(psize - 1);
+                const auto d = (T)TSP::norm(coordinates[i], node);
+                distances[i].push_back(d);
+                distances[idx][i] = d;
+            }
+            
+            // insert the new node into the sorted lists of the other nodes
+            for (unsigned i = 0; i != idx; i++)
+                insert_nearest(i, idx);
+            
+            nearest.emplace_back();
+            sort_nearest(idx);
+            
+            for (auto& c : population)
+                cheapest_insertion(c.tour, idx, distances);
+            
+            update_costs();
+            return idx;
+        }
+        
+        
+        /* Removes a node from the instance: the indices of the following nodes
+         * are shifted down by one and the tours of the population are spliced. */
+        void remove_node(unsigned node)
+        {
+            if (node >= psize || psize < 4)
+                throw invalid_argument("node");
+            
+            coordinates.erase(coordinates.begin() + node);
+            distances.erase(distances.begin() + node);
+            nearest.erase(nearest.begin() + node);
+            psize--;
+            
+            for (auto& row : distances)
+                row.erase(row.begin() + node);
+            
+            // renumbers the nodes following the removed one
+            const auto splice = [node](vector<I>& v)
+            {
+                v.erase(remove(v.begin(), v.end(), node), v.end());
                 
-                for (unsigned j = 0, k = 0; j != psize; j++)
+                for (auto& j : v)
+                {
+                    if (j > node)
+                        j--;
+                }
+            };
+            
+            for (auto& list : nearest)
+                splice(list);
+            
+            for (auto& c : population)
+                splice(c.tour);
+            
+            update_costs();
+        }
+        
+        
+        /* Moves a node to a new position (its distances have to fit T). */
+        void move_node(unsigned node, const pair<double, double>& position)
+        {
+            if (node >= psize || !fits(position, node))
+                throw invalid_argument("node");
+            
+            coordinates[node] = position;
+            
+            for (unsigned i = 0; i != psize; i++)
+            {
+                if (i != node)
+                    distances[i][node] = distances[node][i] = (T)TSP::norm(coordinates[i], position);
+            }
+            
+            // the node changed its rank in every list
+            for (unsigned i = 0; i != psize; i++)
+            {
+                if (i != node)
                 {
-                    if (i != j)
-                        nearest[i][k++] = j;
+                    auto& list = nearest[i];
+                    list.erase(find(list.begin(), list.end(), node));
+                    insert_nearest(i, node);
                 }
+            }
+            
+            sort_nearest(node);
+            
+            // reinsert the node where it is now cheaper
+            for (auto& c : population)
+            {
+                c.tour.erase(find(c.tour.begin(), c.tour.end(), node));
+                cheapest_insertion(c.tour, node, distances);
+            }
+            
+            update_costs();
+        }
+        
+        
+        /* Seeds the population with prior tours (expressed with the current node indices).
+         * Each tour is repaired to the current set of nodes before being added. */
+        void seed(const vector<vector<I>>& tours)
+        {
+            for (auto tour : tours)
+            {
+                if (population.size() >= maxp)
+                    break;
+                
+                repair(tour, distances);
+                add(Chromosome<T, I>(tour, (cost_type<T>)TSP::cost(tour, distances)));
+            }
+        }
+        
+        
+        /* Selects the heuristic functions used to build new individuals:
+         * the i-th slot of the population uses the (i mod size)-th constructor
+         * (the deterministic ones are replaced by randomized ones after the first cycle). */
+        void set_constructors(const vector<Construction>& list)
+        {
+            if (list.empty())
+                throw invalid_argument("list");
+            
+            constructors = list;
+        }
+        
+        
+        /* Gets the edge entropy of the population (normalized in [0, 1]). */
+        double entropy() const
+        {
+            return edges.entropy();
+        }
+        
+        
+        /* Gets the mean edge distance between two individuals (normalized in [0, 1]). */
+        double diversity() const
+        {
+            return edges.distance();
+        }
+        
+        
+        /* Gets the number of individuals sharing each edge. */
+        const EdgeFrequency& edge_frequency() const
+        {
+            return edges;
+        }
+        
+        
+        /* Selects how the population is rebuilt after an extinction. */
+        void set_refill(Refill mode)
+        {
+            refill = mode;
+        }
+        
+        
+        /* Selects the crossover operator. */
+        void set_crossover(Crossover type)
+        {
+            crossover_type = type;
+        }
+        
+        
+        /* Writes a snapshot of the solver state to the file every 'interval' seconds
+         * while solving (an empty file name disables the checkpoints). */
+        void set_checkpoint(const string& filename, double interval)
+        {
+            checkpoint_file = filename;
+            checkpoint_interval = duration<double>(interval);
+        }
+        
+        
+        /* Whether the last snapshot of the last solve could not be written. */
+        bool checkpoint_failed() const
+        {
+            return checkpoint_failure;
+        }
+        
+        
+        /* Writes the solver state in binary form. */
+        void save(ostream& os) const
+        {
+            os.write(snapshot_magic, sizeof(snapshot_magic));
+            write_binary(os, snapshot_version);
+            write_binary(os, (uint64_t)psize);
+            write_binary(os, (uint32_t)sizeof(T));
+            write_binary(os, (uint32_t)sizeof(I));
+            write_binary(os, fingerprint());
+            
+            // random engine
+            stringstream ss;
+            ss << engine;
+            write_binary(os, ss.str());
+            
+            // counters and parameters
+            write_binary(os, mprob);
+            write_binary(os, not_improving_gen);
+            write_binary(os, reference_diversity);
+            write_binary(os, refill);
+            write_binary(os, crossover_type);
+            write_binary(os, constructors);
+            
+            // population
+            write_binary(os, (uint64_t)population.size());
+            
+            for (const auto& c : population)
+            {
+                write_binary(os, c.cost);
+                os.write(reinterpret_cast<const char*>(c.tour.data()), psize * sizeof(I));
+            }
+            
+            edges.write(os);
+        }
+        
+        
+        /* Reads the solver state written by save: the next call to solve resumes from it. */
+        void load(istream& is)
+        {
+            char magic[sizeof(snapshot_magic)];
+            uint32_t version, tsize, isize;
+            uint64_t size, hash;
+            
+            if (!is.read(magic, sizeof(magic)) || !equal(magic, magic + sizeof(magic), snapshot_magic))
+                throw invalid_argument("snapshot");
+            
+            read_binary(is, version);
+            read_binary(is, size);
+            read_binary(is, tsize);
+            read_binary(is, isize);
+            read_binary(is, hash);
+            
+            // the snapshot has to be taken on the same instance
+            if (version != snapshot_version || size != psize || tsize != sizeof(T) || isize != sizeof(I) ||
+                hash != fingerprint())
+                throw invalid_argument("snapshot");
+            
+            // the state is changed only once the whole snapshot has been read
+            string state;
+            read_binary(is, state);
+            stringstream ss(state);
+            auto e = engine;
+            
+            if (!(ss >> e))
+                throw invalid_argument("snapshot");
+            
+            double p, reference;
+            unsigned n;
+            Refill r;
+            Crossover x;
+            vector<Construction> list;
+            read_binary(is, p);
+            read_binary(is, n);
+            read_binary(is, reference);
+            read_binary(is, r);
+            read_binary(is, x);
+            read_binary(is, list);
+            
+            read_binary(is, size);
+            
+            // a corrupt size must not lead to a huge allocation
+            if (size == 0 || size > maxp * (maxp / minp + 2) || list.empty())
+                throw invalid_argument("snapshot");
+            
+            vector<Chromosome<T, I>> individuals(size, Chromosome<T, I>(psize));
+            
+            for (auto& c : individuals)
+            {
+                read_binary(is, c.cost);
                 
-                // sort the indexes according to the distances between nodes
-                // the closest node will appear to the front
-                sort(nearest[i].begin(), nearest[i].end(), [this, i](size_t j1, size_t j2)
-                     { return distances[i][j1] < distances[i][j2]; });
+                if (!is.read(reinterpret_cast<char*>(c.tour.data()), psize * sizeof(I)))
+                    throw invalid_argument("snapshot");
+                
+                // a corrupt tour would index the matrix of distances out of its bounds
+                if (!TSP::permutation(c.tour, psize))
+                    throw invalid_argument("snapshot");
+                
+                // the costs are updated incrementally: they are exact only for integral distances
+                const auto cost = TSP::cost(c.tour, distances);
+                
+                if (abs(c.cost - cost) > 1e-9 * abs(cost))
+                    throw invalid_argument("snapshot");
             }
+            
+            EdgeFrequency frequency;
+            frequency.read(is);
+            
+            engine = e;
+            mprob = p;
+            not_improving_gen = n;
+            reference_diversity = reference;
+            refill = r;
+            crossover_type = x;
+            constructors = move(list);
+            population = move(individuals);
+            edges = move(frequency);
+            
+            resumed = true;
+        }
+        
+        
+        /* Reads the solver state from a snapshot file. */
+        void resume(const string& filename)
+        {
+            ifstream istream(filename, ios::binary);
+            
+            if (!istream.is_open())
+                throw invalid_argument(filename);
+            
+            load(istream);
+        }
+        
+        
+        /* Stops solving as soon as the best tour is within the given gap from the Held-Karp
+         * lower bound, computed on a background thread (0 disables the bound). */
+        void set_target_gap(double gap)
+        {
+            target_gap = gap;
+        }
+        
+        
+        /* Exchanges the best tours with the other islands of an archipelago every 'interval'
+         * seconds while solving (a null island disables the migration). */
+        void set_island(Island<T, I>* island, double interval = 1)
+        {
+            this->island = island;
+            migration_interval = duration<double>(interval);
+        }
+        
+        
+        /* Gets the lower bound computed during the last solve (0 if none). */
+        double lower_bound() const
+        {
+            return bound;
+        }
+        
+        
+        /* Whether the lower bound of the last solve converged (it cannot reach the target gap). */
+        bool lower_bound_converged() const
+        {
+            return bound_converged;
         }
         
         
         /* Solves the TSP problem. */
         template<class S>
-        Chromosome<T> solve(S& stopCriteria, double best_known = 0)
+        Chromosome<T, I> solve(S& stopCriteria, double best_known = 0)
         {
             auto best = init_population();
             //auto n = 0;
             
+            // snapshots are written by a background thread
+            unique_ptr<Checkpoint> checkpoint;
+            auto last_checkpoint = steady_clock::now();
+            checkpoint_failure = false;
+            
+            if (!checkpoint_file.empty())
+                checkpoint.reset(new Checkpoint(checkpoint_file));
+            
+            // the lower bound is computed by a background thread
+            unique_ptr<LowerBound<T, I>> held_karp;
+            
+            if (target_gap > 0)
+                held_karp.reset(new LowerBound<T, I>(distances, nearest, best));
+            
+            // cost of the last tour sent to the other islands
+            auto migrated = numeric_limits<cost_type<T>>::max();
+            auto last_migration = steady_clock::now();
+            
             do
             {
                 if (best <=  best_known)
                     break;
                 
+                if (held_karp)
+                {
+                    held_karp->update_upper(best);
+                    
+                    // the tour is provably good enough
+                    if (best <= held_karp->value() * (1 + target_gap))
+                        break;
+                }
+                
                 // select parents (could be the same)
                 const auto& father = parent();
                 const auto& mather = parent();
@@ -82,9 +512,35 @@ namespace tsp
                 
                 best = update_population(best);
                 //n++;
+                
+                if (island && steady_clock::now() - last_migration >= migration_interval)
+                {
+                    migrate(migrated);
+                    last_migration = steady_clock::now();
+                }
+                
+                if (checkpoint && steady_clock::now() - last_checkpoint >= checkpoint_interval)
+                {
+                    checkpoint->post(snapshot());
+                    last_checkpoint = steady_clock::now();
+                }
             }
             while (!stopCriteria());
             
+            // a failed write does not stop the solve, but the last one is reported
+            if (checkpoint)
+            {
+                checkpoint->post(snapshot());
+                checkpoint->flush();
+                checkpoint_failure = checkpoint->failed();
+            }
+            
+            if (held_karp)
+            {
+                bound = max(bound, held_karp->value());
+                bound_converged = held_karp->finished();
+            }
+            
             return population.front();
         }
         
@@ -95,13 +551,13 @@ namespace tsp
         
         
         /* Implements the genetic crossover operator. */
-        vector<Chromosome<T>> crossover(const Chromosome<T>& p1, const Chromosome<T>& p2)
+        vector<Chromosome<T, I>> crossover(const Chromosome<T, I>& p1, const Chromosome<T, I>& p2)
         {
             // get the size of the tours
             const auto size = p1.tour.size();
             assert(size == p2.tour.size());
             
-            vector<Chromosome<T>> offspring(2, Chromosome<T>(size));
+            vector<Chromosome<T, I>> offspring(2, Chromosome<T, I>(size));
             auto& tour1 = offspring[0].tour;
             auto& tour2 = offspring[1].tour;
             
@@ -163,8 +619,191 @@ namespace tsp
         }
         
         
+        /* Implements the partition crossover operator (GPX). The edges that are not shared by the
+         * parents split the nodes into connected components: when both tours visit a component
+         * through paths between the same pairs of ends (at the shared edges that leave it), the
+         * child (based on the better parent) takes the cheaper of the two sets of paths.
+         * The ends of the replaced paths are added to 'ends'. Linear in the number of nodes. */
+        Chromosome<T, I> partition_crossover(const Chromosome<T, I>& p1, const Chromosome<T, I>& p2,
+                                             vector<I>& ends) const
+        {
+            const auto& base = p2 < p1 ? p2 : p1;
+            const auto& other = p2 < p1 ? p1 : p2;
+            const auto size = base.tour.size();
+            
+            if (size < 5)
+                return base;
+            
+            // positions of the nodes in the tours
+            vector<size_t> pbase(size), pother(size);
+            
+            for (size_t i = 0; i < size; i++)
+            {
+                pbase[base.tour[i]] = i;
+                pother[other.tour[i]] = i;
+            }
+            
+            const auto adjacent = [size](const vector<I>& tour, const vector<size_t>& pos, I a, I b)
+            {
+                const auto i = pos[a];
+                return tour[(i + 1) % size] == b || tour[(i + size - 1) % size] == b;
+            };
+            
+            // union-find of the nodes joined by the edges that are not shared
+            vector<size_t> root(size);
+            
+            for (size_t i = 0; i < size; i++)
+                root[i] = i;
+            
+            const auto find_root = [&root](size_t v)
+            {
+                while (root[v] != v)
+                    v = root[v] = root[root[v]];
+                
+                return v;
+            };
+            
+            for (size_t i = 0; i < size; i++)
+            {
+                const auto a = base.tour[i], b = base.tour[(i + 1) % size];
+                
+                if (!adjacent(other.tour, pother, a, b))
+                    root[find_root(a)] = find_root(b);
+                
+                const auto c = other.tour[i], d = other.tour[(i + 1) % size];
+                
+                if (!adjacent(base.tour, pbase, c, d))
+                    root[find_root(c)] = find_root(d);
+            }
+            
+            vector<size_t> label(size);
+            
+            for (size_t v = 0; v < size; v++)
+                label[v] = find_root(v);
+            
+            // the edges between components are shared: both tours cross the same ones
+            vector<unsigned> crossings(size, 0);
+            vector<double> base_cost(size, 0), other_cost(size, 0);
+            
+            for (size_t i = 0; i < size; i++)
+            {
+                const auto a = base.tour[i], b = base.tour[(i + 1) % size];
+                
+                if (label[a] != label[b])
+                {
+                    crossings[label[a]]++;
+                    crossings[label[b]]++;
+                }
+                else
+                    base_cost[label[a]] += distances[a][b];
+                
+                const auto c = other.tour[i], d = other.tour[(i + 1) % size];
+                
+                if (label[c] == label[d])
+                    other_cost[label[c]] += distances[c][d];
+            }
+            
+            // the tours cross the same edges: the union graph is a single component
+            if (crossings[label[0]] == 0)
+                return base;
+            
+            // each tour visits a component as a set of paths between the ends of the crossed edges:
+            // a component can be exchanged if the ends are paired in the same way by both tours
+            vector<I> base_mate(size), other_mate(size);
+            paths(base.tour, label, base_mate);
+            paths(other.tour, label, other_mate);
+            vector<bool> feasible(size, true);
+            
+            for (size_t i = 0; i < size; i++)
+            {
+                const auto a = base.tour[i], b = base.tour[(i + 1) % size];
+                
+                if (label[a] != label[b])
+                {
+                    if (base_mate[a] != other_mate[a])
+                        feasible[label[a]] = false;
+                    
+                    if (base_mate[b] != other_mate[b])
+                        feasible[label[b]] = false;
+                }
+            }
+            
+            // the components to be taken from the other parent
+            vector<bool> exchanged(size, false);
+            double gain = 0;
+            
+            for (size_t r = 0; r < size; r++)
+            {
+                if (crossings[r] > 0 && feasible[r] && other_cost[r] < base_cost[r])
+                {
+                    exchanged[r] = true;
+                    gain += base_cost[r] - other_cost[r];
+                }
+            }
+            
+            if (gain == 0)
+                return base;
+            
+            for (size_t i = 0; i < size; i++)
+            {
+                const auto a = base.tour[i], b = base.tour[(i + 1) % size];
+                
+                if (label[a] != label[b] && (exchanged[label[a]] || exchanged[label[b]]))
+                {
+                    ends.push_back(a);
+                    ends.push_back(b);
+                }
+            }
+            
+            // walk the child: each node is left through the edges of the parent of its component
+            Chromosome<T, I> child(size);
+            I prev = base.tour.back(), node = base.tour.front();
+            
+            for (size_t i = 0; i < size; i++)
+            {
+                child.tour[i] = node;
+                
+                const auto& tour = exchanged[label[node]] ? other.tour : base.tour;
+                const auto p = exchanged[label[node]] ? pother[node] : pbase[node];
+                const auto next = tour[(p + 1) % size] != prev ? tour[(p + 1) % size] : tour[(p + size - 1) % size];
+                
+                prev = node;
+                node = next;
+            }
+            
+            child.cost = (cost_type<T>)(base.cost - gain);
+            return child;
+        }
+        
+        
+        /* Pairs the first and last nodes of each maximal path of the tour within a component
+         * (the tour has to cross at least one edge between different components). */
+        static void paths(const vector<I>& tour, const vector<size_t>& label, vector<I>& mate)
+        {
+            const auto size = tour.size();
+            size_t first = 0;
+            
+            // start from the first node of a path
+            while (label[tour[(first + size - 1) % size]] == label[tour[first]])
+                first++;
+            
+            for (size_t i = 0, start = first; i < size; i++)
+            {
+                const auto p = (first + i) % size;
+                const auto q = (p + 1) % size;
+                
+                if (label[tour[p]] != label[tour[q]])
+                {
+                    mate[tour[start]] = tour[p];
+                    mate[tour[p]] = tour[start];
+                    start = q;
+                }
+            }
+        }
+        
+        
         /* Implements the genetic mutate operator. */
-        void mutate(Chromosome<T>& c)
+        void mutate(Chromosome<T, I>& c)
         {
             const auto len = (int)c.tour.size() - 1;
             uniform_int_distribution<int> distribution(0, len);
@@ -176,7 +815,7 @@ namespace tsp
         
         
         /* Implements the genetic invert operator. */
-        void invert(Chromosome<T>& chromosome, bool invertGenes = false)
+        void invert(Chromosome<T, I>& chromosome, bool invertGenes = false)
         {
             // get the size of the tours
             const auto size = chromosome.tour.size();
@@ -225,8 +864,29 @@ namespace tsp
         
         
         /* Mate parents. */
-        void mate(const Chromosome<T>& p1, const Chromosome<T>& p2)
+        void mate(const Chromosome<T, I>& p1, const Chromosome<T, I>& p2)
         {
+            if (crossover_type == Crossover::Partition)
+            {
+                vector<I> ends;
+                auto child = partition_crossover(p1, p2, ends);
+                
+                // the parents are locally optimal: only the junctions of the paths are optimized
+                if (!ends.empty())
+                {
+                    child.cost = (cost_type<T>)(child.cost + opt2_local(child.tour, distances, nearest, ends));
+                    
+                    const auto it = find_if(begin(population), end(population),
+                        [&child](const Chromosome<T, I>& c) { return c.cost == child.cost; });
+                    
+                    // avoid similar individuals
+                    if (it == end(population))
+                        add(child);
+                    
+                    return;
+                }
+            }
+            
             // Applies the order crossover operator to mate parents
             auto offspring = crossover(p1, p2);
             uniform_real_distribution<double> distribution;
@@ -240,14 +900,14 @@ namespace tsp
                 // optimize the tour
                 child.opt2(distances, nearest);
                 
-                const auto equal = [&child](const Chromosome<T>& c)
+                const auto equal = [&child](const Chromosome<T, I>& c)
                     { return c.cost == child.cost; };
                 
                 // Avoid similar individuals
                 auto it = find_if(begin(population), end(population), equal);
                 
                 if (it == end(population))
-                    population.emplace_back(child);
+                    add(child);
                 else
                 {
                     // Apply the invert operator
@@ -261,64 +921,114 @@ namespace tsp
                     
                     // Avoid similar individuals
                     if (it == end(population))
-                        population.emplace_back(child);
+                        add(child);
                 }
             }
         }
         
         
+        /* Sends the best tour to the other islands if it improved since the last time, and adds
+         * the tours received from them to the population. */
+        void migrate(cost_type<T>& migrated)
+        {
+            if (population.front().cost < migrated)
+            {
+                migrated = population.front().cost;
+                island->send(population.front());
+            }
+            
+            vector<Chromosome<T, I>> immigrants;
+            island->receive(immigrants);
+            
+            for (auto& c : immigrants)
+            {
+                // the cost sent by the other island is not trusted
+                c.cost = (cost_type<T>)TSP::cost(c.tour, distances);
+                
+                const auto it = find_if(begin(population), end(population),
+                    [&c](const Chromosome<T, I>& p) { return p.cost == c.cost; });
+                
+                // avoid similar individuals
+                if (it == end(population))
+                    add(c);
+            }
+            
+            if (!immigrants.empty())
+                sort(population.begin(), population.end(), less<Chromosome<T, I>>());
+        }
+        
+        
         /* Kill the weakest. */
-        T update_population(T pbest)
+        cost_type<T> update_population(cost_type<T> pbest)
         {
             // sort the population according to the fitness of its individials
-            sort(population.begin(), population.end(), less<Chromosome<T>>());
+            sort(population.begin(), population.end(), less<Chromosome<T, I>>());
+            
+            // 0 when the population is as diverse as after its (re)initialization,
+            // 1 when it lost too much diversity and it can be considered collapsed
+            // (the reference of a population refilled by kicks is low already)
+            const auto diversity = edges.distance();
+            const auto convergence = diversity * psize < min_different_edges ? 1.0 :
+                min(1.0, max(0.0, 1 - diversity / reference_diversity) / max_convergence);
+            
+            // the less diverse the population, the more the children are mutated
+            mprob = base_mprob * (1 + convergence);
             
             if (pbest > population.front().cost)
                 not_improving_gen = 0;
             else
             {
+                // a diverse population is given more time to improve, a collapsed one is
+                // restarted as soon as possible
+                const auto patience = convergence == 1 ?
+                    max_not_improving_gen / 10 : unsigned(max_not_improving_gen * (1.5 - convergence));
+                
                 // check if the population have to be killed
-                if (++not_improving_gen == max_not_improving_gen)
+                if (++not_improving_gen >= patience)
                 {
                     // No improvement for too many generations => extinction
-                    extinction();
+                    extinction(massacre_percentage + (max_massacre_percentage - massacre_percentage) * convergence);
                     
                     // rebuild the population from survivors
-                    fill_population();
+                    if (refill == Refill::IteratedLocalSearch)
+                        kick_population();
+                    else
+                        fill_population(constructors.size());
                     not_improving_gen = 0;
+                    reference_diversity = edges.distance();
                 }
             }
             
             // kill the weakest if any
             if (population.size() > maxp)
-                population.erase(begin(population) + maxp, end(population));
+                kill(maxp, population.size());
             
             return population.front().cost;
         }
         
         
         /* Mass extinction. */
-        void extinction()
+        void extinction(double percentage)
         {
             const auto size = population.size();
-            T tot_fit = 0;
+            cost_type<T> tot_fit = 0;
             
-            const auto nKill = int(size * massacre_percentage) + 1;
+            const auto nKill = int(size * percentage) + 1;
             const auto max_survivors = max(size - nKill, minp);
             
             // compute the total cost of all tours
             for (int i = 0; i < size; i++)
                 tot_fit += population[i].cost;
             
-            vector<T> selprob(size);
+            vector<cost_type<T>> selprob(size);
             
             // compute the probability of being killed
             for (size_t i = 0; i < size; i++)
                 selprob[i] = population[i].cost;
             
-            uniform_int_distribution<int> distribution(0, (int)tot_fit);
-            int index = distribution(engine) + 1;
-            int sum = 0, i;
+            uniform_int_distribution<long long> distribution(0, (long long)tot_fit);
+            long long index = distribution(engine) + 1, sum = 0;
+            int i;
             
             // select which is the weakest survivor
             for (i = 0; sum < index && i < size; i++)
@@ -326,20 +1036,20 @@ namespace tsp
             
             // Kill individuals
             for (int j = (int)population.size() - 1; j >= i && (int)population.size() > minp; j--)
-                population.erase(begin(population) + j);
+                kill(j, j + 1);
             
             // kill individuals in excess
             if (population.size() > max_survivors)
-                population.erase(begin(population) + max_survivors, end(population));
+                kill(max_survivors, population.size());
         }
         
         
         /* Select an individual accorting to its fitness. */
-        const Chromosome<T>& parent()
+        const Chromosome<T, I>& parent()
         {
-            const int candidates_size = (int)population.size() / minp + 2;
-            vector<T> selprob(candidates_size);
-            T tot_fit = 0;
+            const auto candidates_size = (int)min(population.size(), population.size() / minp + 2);
+            vector<cost_type<T>> selprob(candidates_size);
+            cost_type<T> tot_fit = 0;
             
             // compute the total cost of all tours
             for (int i = 0; i < candidates_size; i++)
@@ -349,9 +1059,9 @@ namespace tsp
             for (int i = 0, j = candidates_size - 1; i < candidates_size; i++, j--)
                 selprob[i] = population[j].cost;
             
-            uniform_int_distribution<int> distribution(0, tot_fit + 1);
-            int index = distribution(engine) + 1;
-            int sum = 0, i = 0;
+            uniform_int_distribution<long long> distribution(0, (long long)tot_fit + 1);
+            long long index = distribution(engine) + 1, sum = 0;
+            int i = 0;
             
             // select the parent
             for (; sum < index && i < candidates_size; i++)
@@ -361,52 +1071,238 @@ namespace tsp
         }
         
         
+        /* Gets the solver state in binary form. */
+        string snapshot() const
+        {
+            ostringstream os;
+            save(os);
+            
+            return os.str();
+        }
+        
+        
         /* Initialize the population. */
-        T init_population()
+        cost_type<T> init_population()
         {
-            // init the population with the best/simplest heuristic function
-            population.emplace_back(nearest_neighbor(nearest), distances, nearest);
+            // continue from the loaded state as it is
+            if (resumed)
+            {
+                resumed = false;
+                return population.front().cost;
+            }
             
-            // add random tours to the population
-            fill_population();
+            not_improving_gen = 0;
+            
+            if (!population.empty())
+                warm_population();
+            else
+            {
+                // init the population with the constructor of the first slot
+                add(Chromosome<T, I>(construct(0), distances, nearest));
+                
+                // add the tours of the following slots to the population
+                fill_population();
+            }
             
+            reference_diversity = edges.distance();
             return population.front().cost;
         }
         
         
-        /* Fill the population with random individials. */
-        void fill_population()
+        /* Initialize the population from the (repaired) tours of a previous solve. */
+        void warm_population()
+        {
+            sort(population.begin(), population.end(), less<Chromosome<T, I>>());
+            
+            // avoid similar individuals
+            population.erase(unique(population.begin(), population.end(),
+                [](const Chromosome<T, I>& c1, const Chromosome<T, I>& c2) { return c1.cost == c2.cost; }),
+                population.end());
+            
+            if (population.size() > maxp)
+                population.erase(begin(population) + maxp, end(population));
+            
+            // the repaired seeds are close to a local optimum already: only the best one is
+            // optimized, the others will be improved by mating
+            population.front().opt2(distances, nearest);
+            
+            // reach the minimum size with perturbations of the seeds instead of random tours
+            auto max_attempts = int(minp * 2);
+            
+            while (max_attempts-- > 0 && population.size() < minp)
+            {
+                uniform_int_distribution<size_t> distribution(0, population.size() - 1);
+                auto child = population[distribution(engine)];
+                
+                invert(child);
+                child.opt2(distances, nearest);
+                
+                const auto it = find_if(begin(population), end(population),
+                    [&child](const Chromosome<T, I>& c) { return c.cost == child.cost; });
+                
+                if (it == end(population))
+                    add(child);
+            }
+            
+            // the perturbations of small instances often lead back to the seeds
+            if (population.size() < minp)
+                fill_population();
+            
+            sort(population.begin(), population.end(), less<Chromosome<T, I>>());
+            count_edges();
+        }
+        
+        
+        /* Fill the population with new individials: the slots are numbered from 'first' on
+         * (the slots past the first cycle of constructors only use randomized ones). */
+        void fill_population(size_t first = 0)
         {
             assert(maxp >= minp && minp > 0);
-            static const auto k = maxp / minp + 1;
+            const auto k = maxp / minp + 1;
             auto max_attempts = int(population.size() * k);
             population.reserve(max_attempts);
             
             assert(!distances.empty());
-            const auto size = distances.front().size();
-            vector<unsigned> tour(size);
+            // number of discarded tours, used to move to the next constructor
+            size_t discarded = 0;
             
-            // init the tour
-            for (unsigned i = 0; i < size; i++)
-                tour[i] = i;
-            
-            // fills the population with random tours
+            // fills the population with the tours of the constructor of each slot
             while (max_attempts-- > 0 && population.size() < maxp)
             {
-                // randomize the tour
-                shuffle(tour.begin(), tour.end(), engine);
+                auto tour = construct(first + population.size() + discarded);
                 // optimize the tour
                 const auto cost = opt2(tour, distances);
                 
                 const auto it = find_if(begin(population), end(population),
-                    [cost](const Chromosome<T>& c) { return cost == c.cost; });
+                    [cost](const Chromosome<T, I>& c) { return cost == c.cost; });
+                
+                // avoid similar individuals
+                if (it == end(population))
+                    add(Chromosome<T, I>(tour, cost));
+                else
+                    discarded++;
+            }
+            
+            sort(population.begin(), population.end(), less<Chromosome<T, I>>());
+        }
+        
+        
+        /* Fill the population with perturbations of the survivors: a double-bridge kick is
+         * applied to a segment of a survivor and only the nodes around the kicked edges
+         * are optimized again. */
+        void kick_population()
+        {
+            assert(maxp >= minp && minp > 0);
+            const auto survivors = population.size();
+            auto max_attempts = int(survivors * (maxp / minp + 1));
+            
+            uniform_int_distribution<size_t> distribution(0, survivors - 1);
+            vector<I> touched;
+            
+            while (max_attempts-- > 0 && population.size() < maxp)
+            {
+                auto child = population[distribution(engine)];
+                touched.clear();
+                
+                auto cost = child.cost + double_bridge(child.tour, distances, engine, touched);
+                cost += opt2_local(child.tour, distances, nearest, touched);
+                child.cost = (cost_type<T>)cost;
+                
+                const auto it = find_if(begin(population), end(population),
+                    [&child](const Chromosome<T, I>& c) { return c.cost == child.cost; });
                 
                 // avoid similar individuals
                 if (it == end(population))
-                    population.emplace_back(tour, cost);
+                    add(child);
             }
             
-            sort(population.begin(), population.end(), less<Chromosome<T>>());
+            sort(population.begin(), population.end(), less<Chromosome<T, I>>());
+        }
+        
+        
+        /* Builds a new tour with the constructor selected for the given population slot.
+         * The deterministic constructors would always build the same tour: they are only used
+         * in the first cycle of slots, and replaced by their randomized variants afterwards. */
+        vector<I> construct(size_t slot)
+        {
+            assert(!constructors.empty());
+            auto type = constructors[slot % constructors.size()];
+            
+            if (slot >= constructors.size())
+                type = randomized(type);
+            
+            switch (type)
+            {
+                case Construction::NearestNeighbor:
+                    return nearest_neighbor(nearest);
+                    
+                case Construction::RandomNearestNeighbor:
+                    return random_nearest_neighbor(nearest, engine);
+                    
+                case Construction::GreedyEdge:
+                    return greedy_edge(nearest, distances);
+                    
+                case Construction::RandomGreedyEdge:
+                    return random_greedy_edge(nearest, distances, engine);
+                    
+                case Construction::SpaceFillingCurve:
+                    return space_filling_curve<I>(coordinates);
+                    
+                default:
+                    break;
+            }
+            
+            vector<I> tour(psize);
+            
+            for (size_t i = 0; i < psize; i++)
+                tour[i] = (I)i;
+            
+            shuffle(tour.begin(), tour.end(), engine);
+            return tour;
+        }
+        
+        
+        /* Gets the randomized variant of a constructor. */
+        static Construction randomized(Construction type)
+        {
+            switch (type)
+            {
+                case Construction::NearestNeighbor:
+                    return Construction::RandomNearestNeighbor;
+                    
+                case Construction::GreedyEdge:
+                case Construction::SpaceFillingCurve:
+                    return Construction::RandomGreedyEdge;
+                    
+                default:
+                    return type;
+            }
+        }
+        
+        
+        /* Whether the distances between a position and the nodes (but the given one) fit T. */
+        bool fits(const pair<double, double>& position, size_t except) const
+        {
+            for (size_t i = 0; i != psize; i++)
+            {
+                if (i != except && TSP::norm(coordinates[i], position) > (double)numeric_limits<T>::max())
+                    return false;
+            }
+            
+            return true;
+        }
+        
+        
+        /* Gets a hash of the coordinates of the nodes (FNV-1a), which identifies the instance. */
+        uint64_t fingerprint() const
+        {
+            uint64_t hash = 14695981039346656037ull;
+            const auto bytes = reinterpret_cast<const unsigned char*>(coordinates.data());
+            
+            for (size_t i = 0; i < coordinates.size() * sizeof(coordinates[0]); i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            
+            return hash;
         }
         
         
@@ -417,17 +1313,86 @@ namespace tsp
         }
         
         
+        /* Sorts the list of the nodes closest to the given one. */
+        void sort_nearest(unsigned i)
+        {
+            auto& list = nearest[i];
+            list.resize(psize - 1);
+            
+            for (unsigned j = 0, k = 0; j != psize; j++)
+            {
+                if (i != j)
+                    list[k++] = (I)j;
+            }
+            
+            // sort the indexes according to the distances between nodes
+            // the closest node will appear to the front
+            sort(list.begin(), list.end(), [this, i](size_t j1, size_t j2)
+                 { return distances[i][j1] < distances[i][j2]; });
+        }
+        
+        
+        /* Inserts a node into the (sorted) list of the nodes closest to the given one. */
+        void insert_nearest(unsigned i, unsigned node)
+        {
+            auto& list = nearest[i];
+            const auto it = std::lower_bound(list.begin(), list.end(), (I)node, [this, i](I j1, I j2)
+                { return distances[i][j1] < distances[i][j2]; });
+            
+            list.insert(it, (I)node);
+        }
+        
+        
+        /* Updates the cost of every individual after the instance has changed. */
+        void update_costs()
+        {
+            for (auto& c : population)
+                c.cost = (cost_type<T>)TSP::cost(c.tour, distances);
+            
+            sort(population.begin(), population.end(), less<Chromosome<T, I>>());
+            count_edges();
+        }
+        
+        
+        /* Rebuilds the table of edge frequencies from the whole population. */
+        void count_edges()
+        {
+            edges.clear();
+            
+            for (const auto& c : population)
+                edges.add(c.tour);
+        }
+        
+        
+        /* Adds an individual to the population. */
+        void add(const Chromosome<T, I>& c)
+        {
+            edges.add(c.tour);
+            population.emplace_back(c);
+        }
+        
+        
+        /* Kills the individuals in the range [first, last) of the population. */
+        void kill(size_t first, size_t last)
+        {
+            for (auto i = first; i < last; i++)
+                edges.remove(population[i].tour);
+            
+            population.erase(begin(population) + first, begin(population) + last);
+        }
+        
+        
         
         
         
         // nodes coordinates
-        const vector<pair<double, double>> coordinates;
+        vector<pair<double, double>> coordinates;
         
         // number of nodes
-        const size_t psize;
+        size_t psize;
         
         // matrix of distances between nodes
-        const vector<vector<T>> distances;
+        vector<vector<T>> distances;
         
         // Minimum number of individuals (avoid extincion)
         const size_t minp;
@@ -436,15 +1401,18 @@ namespace tsp
         const size_t maxp;
         
         // matrix of nearest nodes
-        vector<vector<unsigned>> nearest;
+        vector<vector<I>> nearest;
         
         // population
-        vector<Chromosome<T>> population;
+        vector<Chromosome<T, I>> population;
         
         // random engine
         default_random_engine engine;
         
-        // mutation probability
+        // mutation probability of a diverse population
+        const double base_mprob;
+        
+        // mutation probability (adapted to the diversity of the population)
         double mprob;
         
         // number of steps that didn't lead to improvements
@@ -456,7 +1424,69 @@ namespace tsp
         // minimum percentage of individuals that need to be killed during an extinction
         const double massacre_percentage;
         
+        // percentage of individuals killed during the extinction of a collapsed population
+        const double max_massacre_percentage;
+        
+        // fraction of the reference diversity whose loss means the population collapsed
+        const double max_convergence;
+        
+        // mean number of different edges between tours below which the population is collapsed
+        const double min_different_edges;
+        
+        // mean edge distance between tours after the last (re)initialization of the population
+        double reference_diversity;
+        
+        // number of individuals sharing each edge
+        EdgeFrequency edges;
+        
+        // heuristic functions used to build the individuals of each population slot
+        vector<Construction> constructors;
+        
+        // how the population is rebuilt after an extinction
+        Refill refill;
+        
+        // operator used to mate the parents
+        Crossover crossover_type;
+        
+        // file where the snapshots of the solver state are written (none if empty)
+        string checkpoint_file;
+        
+        // time between two snapshots
+        duration<double> checkpoint_interval;
+        
+        // whether the last snapshot could not be written
+        bool checkpoint_failure;
+        
+        // whether the state has been loaded from a snapshot
+        bool resumed;
+        
+        // gap from the lower bound within which the solve stops
+        double target_gap;
+        
+        // last lower bound computed
+        double bound;
+        
+        // whether the last lower bound cannot be improved any further
+        bool bound_converged;
+        
+        // archipelago the best tours are exchanged with (none if null)
+        Island<T, I>* island;
+        
+        // time between two migrations
+        duration<double> migration_interval;
+        
+        // header of the snapshots
+        static constexpr char snapshot_magic[4] = { 'G', 'T', 'S', 'P' };
+        static constexpr uint32_t snapshot_version = 4;
+        
     };
+    
+    
+    template<class T, class I>
+    constexpr char GTSP<T, I>::snapshot_magic[4];
+    
+    template<class T, class I>
+    constexpr uint32_t GTSP<T, I>::snapshot_version;
 }
 
 
@@ -12,6 +12,11 @@ using namespace tsp;
 #include <cmath>
 #include <algorithm>
 #include <stdexcept>
+#include <random>
+#include <array>
+#include <tuple>
+#include <deque>
+#include <cstdint>
 using namespace std;
 
 
@@ -31,13 +36,14 @@ namespace tsp
     
     
     /* Gets the tour of nodes according to the nearest neighbor heuristic. */
-    vector<unsigned> nearest_neighbor(const vector<vector<unsigned>>& nearest)
+    template<class I>
+    vector<I> nearest_neighbor(const vector<vector<I>>& nearest)
     {
         if (nearest.empty())
             throw invalid_argument("nearest");
         
         const auto len = nearest.front().size() + 1;
-        vector<unsigned> tour(len);
+        vector<I> tour(len);
         
         // list of nodes still available
         vector<bool> available(len, true);
@@ -63,14 +69,513 @@ namespace tsp
     }
     
     
+    /* Heuristic functions used to build the tours of the initial population. */
+    enum class Construction
+    {
+        NearestNeighbor,
+        RandomNearestNeighbor,
+        GreedyEdge,
+        RandomGreedyEdge,
+        SpaceFillingCurve,
+        Random
+    };
+    
+    
+    /* Gets the tour of nodes according to the nearest neighbor heuristic, starting from a
+     * random node and skipping the closest available node with the given probability
+     * (every skip leaves a node behind to be reached later by a long edge: the tours are
+     * mainly randomized by their start). */
+    template<class I, class G>
+    vector<I> random_nearest_neighbor(const vector<vector<I>>& nearest, G& engine,
+                                      double skip = 0.01)
+    {
+        if (nearest.empty())
+            throw invalid_argument("nearest");
+        
+        const auto len = nearest.front().size() + 1;
+        vector<I> tour(len);
+        vector<bool> available(len, true);
+        
+        uniform_int_distribution<unsigned> start(0, (unsigned)len - 1);
+        bernoulli_distribution skip_closest(skip);
+        
+        tour[0] = (I)start(engine);
+        available[tour[0]] = false;
+        
+        for (size_t i = 1; i < len; i++)
+        {
+            const auto j = tour[i - 1];
+            size_t idx = 0;
+            
+            // select the index of the closest node still available
+            while (!available[nearest[j][idx]])
+                idx++;
+            
+            // randomly select the second closest one instead
+            if (i < len - 1 && skip_closest(engine))
+            {
+                auto next = idx + 1;
+                
+                while (!available[nearest[j][next]])
+                    next++;
+                
+                idx = next;
+            }
+            
+            tour[i] = nearest[j][idx];
+            available[tour[i]] = false;
+        }
+        
+        return tour;
+    }
+    
+    
+    /* Gets the tour of nodes according to the greedy edge matching heuristic: the candidate
+     * edges are taken from the lists of nearest nodes and are weighted by the given function. */
+    template<class I, class W>
+    vector<I> greedy_matching(const vector<vector<I>>& nearest, W weight, unsigned candidates)
+    {
+        if (nearest.empty())
+            throw invalid_argument("nearest");
+        
+        const auto len = (unsigned)nearest.front().size() + 1;
+        const auto none = numeric_limits<unsigned>::max();
+        const auto k = min<size_t>(candidates, len - 1);
+        
+        // list of candidate edges (weight, node, node)
+        vector<tuple<double, unsigned, unsigned>> edges;
+        edges.reserve(len * k);
+        
+        for (unsigned i = 0; i < len; i++)
+        {
+            for (size_t n = 0; n < k; n++)
+            {
+                const unsigned j = nearest[i][n];
+                edges.emplace_back(weight(min(i, j), max(i, j)), min(i, j), max(i, j));
+            }
+        }
+        
+        sort(edges.begin(), edges.end());
+        edges.erase(unique(edges.begin(), edges.end()), edges.end());
+        
+        // nodes adjacent to each node and fragment each node belongs to
+        vector<array<unsigned, 2>> adj(len, array<unsigned, 2>{ { none, none } });
+        vector<unsigned> fragment(len);
+        
+        for (unsigned i = 0; i < len; i++)
+            fragment[i] = i;
+        
+        const auto root = [&fragment](unsigned i)
+        {
+            while (fragment[i] != i)
+                i = fragment[i] = fragment[fragment[i]];
+            
+            return i;
+        };
+        
+        const auto degree = [&adj, none](unsigned i)
+        {
+            return (adj[i][0] != none) + (adj[i][1] != none);
+        };
+        
+        // add the shortest edges that do not close a cycle nor exceed degree 2
+        for (const auto& e : edges)
+        {
+            const auto i = get<1>(e);
+            const auto j = get<2>(e);
+            
+            if (degree(i) == 2 || degree(j) == 2)
+                continue;
+            
+            const auto ri = root(i);
+            const auto rj = root(j);
+            
+            if (ri == rj)
+                continue;
+            
+            fragment[ri] = rj;
+            adj[i][adj[i][0] != none] = j;
+            adj[j][adj[j][0] != none] = i;
+        }
+        
+        // join the fragments walking from the end of each one to the closest free endpoint
+        vector<I> tour;
+        tour.reserve(len);
+        vector<bool> visited(len, false);
+        
+        auto start = none;
+        
+        for (unsigned i = 0; i < len && start == none; i++)
+        {
+            if (degree(i) < 2)
+                start = i;
+        }
+        
+        while (start != none)
+        {
+            auto current = start;
+            
+            while (current != none)
+            {
+                tour.push_back((I)current);
+                visited[current] = true;
+                
+                auto next = none;
+                
+                for (auto j : adj[current])
+                {
+                    if (j != none && !visited[j])
+                        next = j;
+                }
+                
+                current = next;
+            }
+            
+            const auto end = tour.back();
+            start = none;
+            
+            if (tour.size() < len)
+            {
+                for (auto j : nearest[end])
+                {
+                    if (!visited[j] && degree(j) < 2)
+                    {
+                        start = j;
+                        break;
+                    }
+                }
+            }
+        }
+        
+        return tour;
+    }
+    
+    
+    /* Gets the tour of nodes according to the greedy edge heuristic. */
+    template<class T, class I>
+    vector<I> greedy_edge(const vector<vector<I>>& nearest,
+                          const vector<vector<T>>& distances, unsigned candidates = 10)
+    {
+        return greedy_matching(nearest, [&distances](unsigned i, unsigned j)
+            { return (double)distances[i][j]; }, candidates);
+    }
+    
+    
+    /* Gets the tour of nodes according to the greedy edge heuristic, where the length of each
+     * candidate edge is randomly increased up to the given percentage. */
+    template<class T, class I, class G>
+    vector<I> random_greedy_edge(const vector<vector<I>>& nearest,
+                                 const vector<vector<T>>& distances, G& engine,
+                                 double noise = 0.1, unsigned candidates = 10)
+    {
+        uniform_real_distribution<double> distribution(1, 1 + noise);
+        
+        return greedy_matching(nearest, [&distances, &distribution, &engine](unsigned i, unsigned j)
+            { return distances[i][j] * distribution(engine); }, candidates);
+    }
+    
+    
+    /* Gets the tour of nodes sorted according to their position along the Hilbert curve.
+     * https://en.wikipedia.org/wiki/Hilbert_curve */
+    template<class I = unsigned>
+    vector<I> space_filling_curve(const vector<pair<double, double>>& coordinates)
+    {
+        if (coordinates.empty())
+            throw invalid_argument("coordinates");
+        
+        const auto len = coordinates.size();
+        
+        // bounding box of the nodes
+        auto xmin = coordinates.front().first, xmax = xmin;
+        auto ymin = coordinates.front().second, ymax = ymin;
+        
+        for (const auto& c : coordinates)
+        {
+            xmin = min(xmin, c.first);
+            xmax = max(xmax, c.first);
+            ymin = min(ymin, c.second);
+            ymax = max(ymax, c.second);
+        }
+        
+        // the nodes are mapped on a grid of side 2^16
+        const uint32_t side = 1 << 16;
+        const auto scale = (side - 1) / max(max(xmax - xmin, ymax - ymin), 1e-9);
+        vector<pair<uint64_t, unsigned>> keys(len);
+        
+        for (unsigned i = 0; i < len; i++)
+        {
+            auto x = (uint32_t)((coordinates[i].first - xmin) * scale);
+            auto y = (uint32_t)((coordinates[i].second - ymin) * scale);
+            uint64_t d = 0;
+            
+            for (uint32_t s = side / 2; s > 0; s /= 2)
+            {
+                const uint32_t rx = (x & s) > 0;
+                const uint32_t ry = (y & s) > 0;
+                d += (uint64_t)s * s * ((3 * rx) ^ ry);
+                
+                // rotate the quadrant
+                if (ry == 0)
+                {
+                    if (rx == 1)
+                    {
+                        x = side - 1 - x;
+                        y = side - 1 - y;
+                    }
+                    
+                    swap(x, y);
+                }
+            }
+            
+            keys[i] = make_pair(d, i);
+        }
+        
+        sort(keys.begin(), keys.end());
+        vector<I> tour(len);
+        
+        for (size_t i = 0; i < len; i++)
+            tour[i] = (I)keys[i].second;
+        
+        return tour;
+    }
+    
+    
+    /* Inserts the node in the tour at the position that minimizes the increase of its cost. */
+    template<class T, class I>
+    void cheapest_insertion(vector<I>& tour, size_t node, const vector<vector<T>>& distances)
+    {
+        const auto len = tour.size();
+        
+        if (len < 2)
+        {
+            tour.push_back((I)node);
+            return;
+        }
+        
+        // position of the edge (i, i+1) that will be broken
+        size_t best_pos = 0;
+        auto best_delta = numeric_limits<double>::max();
+        
+        for (size_t i = 0; i < len; i++)
+        {
+            const auto a = tour[i];
+            const auto b = tour[(i + 1) % len];
+            const double delta = (double)distances[a][node] + distances[node][b] - distances[a][b];
+            
+            if (delta < best_delta)
+            {
+                best_delta = delta;
+                best_pos = i;
+            }
+        }
+        
+        tour.insert(tour.begin() + best_pos + 1, (I)node);
+    }
+    
+    
+    /* Repairs a tour so that it visits every node of the instance exactly once:
+     * unknown and duplicated nodes are spliced out, missing nodes are added by
+     * cheapest insertion. */
+    template<class T, class I>
+    void repair(vector<I>& tour, const vector<vector<T>>& distances)
+    {
+        const auto size = distances.size();
+        vector<bool> visited(size, false);
+        
+        // splice out the nodes that do not belong to the instance
+        tour.erase(remove_if(tour.begin(), tour.end(), [&visited, size](I node)
+        {
+            if (node >= size || visited[node])
+                return true;
+            
+            visited[node] = true;
+            return false;
+        }), tour.end());
+        
+        // add the missing nodes
+        for (size_t node = 0; node < size; node++)
+        {
+            if (!visited[node])
+                cheapest_insertion(tour, node, distances);
+        }
+    }
+    
+    
+    /* Applies a double-bridge kick to a segment of the tour (A B C D => A C B D), where the
+     * segments B and C are cut within a window of the given length. The nodes at the ends of
+     * the changed edges are added to the list of touched nodes. Returns the cost change. */
+    template<class T, class I, class G>
+    double double_bridge(vector<I>& tour, const vector<vector<T>>& distances, G& engine,
+                         vector<I>& touched, unsigned window = 50)
+    {
+        const auto len = tour.size();
+        
+        if (len < 8)
+            return 0;
+        
+        window = (unsigned)min<size_t>(window, len - 2);
+        
+        // the segment B starts after 'start', C starts after 'start + o1' and ends at 'start + o2'
+        uniform_int_distribution<size_t> d1(0, len - 1);
+        uniform_int_distribution<unsigned> d2(1, window);
+        const auto start = d1(engine);
+        auto o1 = d2(engine);
+        auto o2 = d2(engine);
+        
+        while (o1 == o2)
+            o2 = d2(engine);
+        
+        if (o1 > o2)
+            swap(o1, o2);
+        
+        const auto at = [&tour, len, start](size_t i) -> I& { return tour[(start + i) % len]; };
+        
+        const auto a = at(0), b1 = at(1), b2 = at(o1), c1 = at(o1 + 1), c2 = at(o2), d = at(o2 + 1);
+        const double delta = (double)distances[a][c1] + distances[c2][b1] + distances[b2][d]
+            - distances[a][b1] - distances[b2][c1] - distances[c2][d];
+        
+        // reorder the nodes of the window
+        vector<I> segment;
+        segment.reserve(o2);
+        
+        for (auto i = o1 + 1; i <= o2; i++)
+            segment.push_back(at(i));
+        
+        for (unsigned i = 1; i <= o1; i++)
+            segment.push_back(at(i));
+        
+        for (unsigned i = 1; i <= o2; i++)
+            at(i) = segment[i - 1];
+        
+        touched.insert(touched.end(), { a, b1, b2, c1, c2, d });
+        return delta;
+    }
+    
+    
+    /* 2-opt restricted to the lists of nearest nodes, which only processes the given nodes
+     * and the ones whose adjacent edges change (don't look bits). Returns the cost change. */
+    template<class T, class I>
+    double opt2_local(vector<I>& tour, const vector<vector<T>>& distances,
+                      const vector<vector<I>>& nearest, const vector<I>& nodes,
+                      unsigned candidates = 10)
+    {
+        const auto len = tour.size();
+        
+        if (len < 5)
+            return 0;
+        
+        vector<unsigned> pos(len);
+        
+        for (size_t i = 0; i < len; i++)
+            pos[tour[i]] = (unsigned)i;
+        
+        const auto succ = [&tour, &pos, len](I n) { return tour[(pos[n] + 1) % len]; };
+        const auto pred = [&tour, &pos, len](I n) { return tour[(pos[n] + len - 1) % len]; };
+        
+        // reverses the path of the tour from the node at 'from' to the one at 'to'
+        const auto reverse_path = [&tour, &pos, len](size_t from, size_t to)
+        {
+            auto steps = (to + len - from) % len + 1;
+            
+            // reverse the complementary path if shorter (the tour is the same)
+            if (2 * steps > len)
+            {
+                swap(from, to);
+                from = (from + 1) % len;
+                to = (to + len - 1) % len;
+                steps = len - steps;
+            }
+            
+            for (size_t k = 0; k < steps / 2; k++)
+            {
+                swap(tour[from], tour[to]);
+                pos[tour[from]] = (unsigned)from;
+                pos[tour[to]] = (unsigned)to;
+                from = (from + 1) % len;
+                to = (to + len - 1) % len;
+            }
+        };
+        
+        // nodes still to be processed
+        vector<bool> active(len, false);
+        deque<I> queue;
+        
+        const auto activate = [&active, &queue](I n)
+        {
+            if (!active[n])
+            {
+                active[n] = true;
+                queue.push_back(n);
+            }
+        };
+        
+        for (auto n : nodes)
+            activate(n);
+        
+        const auto k = min<size_t>(candidates, len - 1);
+        double delta = 0;
+        
+        while (!queue.empty())
+        {
+            const auto a = queue.front();
+            queue.pop_front();
+            active[a] = false;
+            
+            for (int forward = 1; forward >= 0; forward--)
+            {
+                const auto b = forward ? succ(a) : pred(a);
+                const auto dab = distances[a][b];
+                auto improved = false;
+                
+                for (size_t n = 0; n < k && !improved; n++)
+                {
+                    const auto c = nearest[a][n];
+                    
+                    // the new edge (a, c) has to be shorter than the removed (a, b)
+                    if (distances[a][c] >= dab)
+                        break;
+                    
+                    const auto d = forward ? succ(c) : pred(c);
+                    
+                    if (c == b || d == a)
+                        continue;
+                    
+                    const double gain = (double)distances[a][c] + distances[b][d] - dab - distances[c][d];
+                    
+                    if (gain < 0)
+                    {
+                        // replace the edges (a, b) and (c, d) with (a, c) and (b, d)
+                        if (forward)
+                            reverse_path(pos[b], pos[c]);
+                        else
+                            reverse_path(pos[a], pos[d]);
+                        
+                        delta += gain;
+                        improved = true;
+                        
+                        activate(a);
+                        activate(b);
+                        activate(c);
+                        activate(d);
+                    }
+                }
+                
+                if (improved)
+                    break;
+            }
+        }
+        
+        return delta;
+    }
+    
+    
     /* https://en.wikipedia.org/wiki/2-opt */
-    template<class T>
-    double opt2(vector<unsigned>& tour, const vector<vector<T>>& distances,
+    template<class T, class I>
+    double opt2(vector<I>& tour, const vector<vector<T>>& distances,
               unsigned max_attempts = 20)
     {
         // Get tour size
         const auto size = tour.size();
-        vector<unsigned> ntour(size);
         
         // repeat until no improvement is made
         unsigned improve = 0;
@@ -78,33 +583,36 @@ namespace tsp
         
         while (improve++ < max_attempts)
         {
-            for (int i = 0; i < size - 1; i++)
+            auto improved = false;
+            
+            for (size_t i = 0; i + 1 < size; i++)
             {
-                for (int k = i + 1; k < size; k++)
+                for (size_t k = i + 1; k < size; k++)
                 {
-                    // 1. take route[0] to route[i-1] and add them in order to new_route
-                    for (int c = 0; c <= i - 1; c++)
-                        ntour[c] = tour[c];
+                    // reversing the whole tour does not change it
+                    if (i == 0 && k == size - 1)
+                        continue;
                     
-                    // 2. take route[i] to route[k] and add them in reverse order to new_route
-                    for (int c = i, dec = 0; c <= k; c++, dec++)
-                        ntour[c] = tour[k - dec];
+                    // reversing route[i] to route[k] only changes the two edges at its ends
+                    const auto prev = tour[(i + size - 1) % size];
+                    const auto next = tour[(k + 1) % size];
+                    const double delta = (double)distances[prev][tour[k]] + distances[tour[i]][next]
+                        - distances[prev][tour[i]] - distances[tour[k]][next];
                     
-                    // 3. take route[k+1] to end and add them in order to new_route
-                    for (int c = k + 1; c < size; c++)
-                        ntour[c] = tour[c];
-                    
-                    const auto cost = TSP::cost(ntour, distances);
-                    
-                    if (cost < best_cost)
+                    if (delta < 0)
                     {
                         // reset improvement
                         improve = 0;
-                        tour = ntour;
-                        best_cost = cost;
+                        improved = true;
+                        reverse(tour.begin() + i, tour.begin() + k + 1);
+                        best_cost += delta;
                     }
                 }
             }
+            
+            // a pass without improvements leaves the tour as it is, and so would the next ones
+            if (!improved)
+                break;
         }
         
         return best_cost;
@@ -0,0 +1,544 @@
+#ifndef ISLAND_HPP
+#define ISLAND_HPP
+
+
+#include "Chromosome.hpp"
+#include "TSP.hpp"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+using namespace chrono;
+
+
+namespace tsp
+{
+    /* Connects the process to the other islands of an archipelago of cooperating processes,
+     * each one solving the same instance with its own population. The island k listens on the
+     * Unix domain socket "<path>.k" and connects to every island with a lower index. The best
+     * tours are sent to all the islands and received on a background thread, so that the
+     * migration never blocks the solver. The islands also share the best cost and the stop. */
+    template<class T, class I = unsigned>
+    struct Island
+    {
+        /* Starts listening as the island 'index' of 'count' islands, on tours of 'nodes' nodes. */
+        explicit Island(const string& path, unsigned index, unsigned count, size_t nodes)
+        : path(path),
+        index(index),
+        count(count),
+        nodes(nodes),
+        linked(index, false),
+        best_cost(numeric_limits<double>::max()),
+        stop_signal(false),
+        quit(false),
+        listener(-1)
+        {
+            if (count == 0 || index >= count)
+                throw invalid_argument("index");
+            
+            if (nodes == 0 || nodes > numeric_limits<uint32_t>::max())
+                throw invalid_argument("nodes");
+            
+            const auto address = socket_address(index);
+            
+            if (pipe(wakeup) != 0)
+                throw runtime_error("pipe");
+            
+            nonblocking(wakeup[0]);
+            nonblocking(wakeup[1]);
+            
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            unlink(address.sun_path);
+            
+            if (listener < 0 || ::bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 ||
+                listen(listener, (int)count) != 0)
+            {
+                close_all();
+                throw invalid_argument(path);
+            }
+            
+            nonblocking(listener);
+            worker = thread(&Island::run, this);
+        }
+        
+        
+        /* Sends the pending messages (for a short while at most) and closes the connections. */
+        ~Island()
+        {
+            quit = true;
+            wake();
+            worker.join();
+            
+            unlink(socket_address(index).sun_path);
+            close_all();
+        }
+        
+        
+        /* Sends a tour to all the other islands (without waiting for the transmission). */
+        void send(const Chromosome<T, I>& c)
+        {
+            Header header = { tour_message, (uint32_t)c.tour.size(), (double)c.cost };
+            string message(reinterpret_cast<const char*>(&header), sizeof(header));
+            message.append(reinterpret_cast<const char*>(c.tour.data()), c.tour.size() * sizeof(I));
+            
+            update_best(header.cost);
+            
+            {
+                lock_guard<mutex> lock(m);
+                outbox += message;
+                last_tour = move(message);
+            }
+            
+            wake();
+        }
+        
+        
+        /* Moves the tours received from the other islands since the last call into 'tours'. */
+        void receive(vector<Chromosome<T, I>>& tours)
+        {
+            lock_guard<mutex> lock(m);
+            move(inbox.begin(), inbox.end(), back_inserter(tours));
+            inbox.clear();
+        }
+        
+        
+        /* Gets the lowest cost sent or received by this island. */
+        double best() const
+        {
+            return best_cost;
+        }
+        
+        
+        /* Stops all the islands. */
+        void stop()
+        {
+            Header header = { stop_message, 0, 0 };
+            
+            {
+                lock_guard<mutex> lock(m);
+                outbox.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            }
+            
+            stop_signal = true;
+            wake();
+        }
+        
+        
+        /* Whether an island (this one included) has stopped. */
+        bool stopped() const
+        {
+            return stop_signal;
+        }
+    
+    
+    
+    
+    private:
+        
+        
+        // header of the messages: the tour messages are followed by the indices of the nodes
+        struct Header
+        {
+            uint32_t type;
+            uint32_t nodes;
+            double cost;
+        };
+        
+        
+        // connection with another island
+        struct Peer
+        {
+            int fd;
+            string in;
+            string out;
+            
+            // island connected to (-1 for the accepted connections)
+            int island;
+            
+            // whether the connection is not established yet
+            bool connecting;
+        };
+        
+        
+        static constexpr uint32_t tour_message = 1;
+        static constexpr uint32_t stop_message = 2;
+        
+        
+        /* Background thread: connects to the other islands and moves the messages. */
+        void run()
+        {
+            auto last_attempt = steady_clock::time_point();
+            auto deadline = steady_clock::time_point::max();
+            
+            while (true)
+            {
+                // the pending messages are sent before leaving
+                if (quit && deadline == steady_clock::time_point::max())
+                    deadline = steady_clock::now() + seconds(1);
+                
+                const auto flushed = all_of(peers.begin(), peers.end(), [](const Peer& p) { return p.out.empty(); });
+                
+                if (quit && ((flushed && outbox_empty()) || steady_clock::now() >= deadline))
+                    break;
+                
+                // the islands with a lower index may not be listening yet
+                if (steady_clock::now() - last_attempt >= milliseconds(100))
+                {
+                    connect_peers();
+                    last_attempt = steady_clock::now();
+                }
+                
+                vector<pollfd> fds = { { wakeup[0], POLLIN, 0 }, { listener, POLLIN, 0 } };
+                
+                for (const auto& p : peers)
+                {
+                    const auto events = p.connecting ? POLLOUT : POLLIN | (p.out.empty() ? 0 : POLLOUT);
+                    fds.push_back({ p.fd, short(events), 0 });
+                }
+                
+                if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR)
+                    break;
+                
+                char buffer[4096];
+                
+                while (read(wakeup[0], buffer, sizeof(buffer)) > 0)
+                    ;
+                
+                // the messages of the solver are queued to every connected island
+                {
+                    lock_guard<mutex> lock(m);
+                    
+                    for (auto& p : peers)
+                        p.out += outbox;
+                    
+                    outbox.clear();
+                }
+                
+                if (fds[1].revents & POLLIN)
+                    accept_peers();
+                
+                // the connections of the islands that left are closed
+                for (size_t i = 0; i < peers.size() && i + 2 < fds.size(); i++)
+                {
+                    if (peers[i].connecting)
+                    {
+                        if (fds[i + 2].revents != 0)
+                            connected(peers[i]);
+                        
+                        continue;
+                    }
+                    
+                    if ((fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR) && !read_peer(peers[i])) ||
+                        (fds[i + 2].revents & POLLOUT && !write_peer(peers[i])))
+                    {
+                        close(peers[i].fd);
+                        peers[i].fd = -1;
+                    }
+                }
+                
+                peers.erase(remove_if(peers.begin(), peers.end(), [](const Peer& p) { return p.fd < 0; }), peers.end());
+            }
+        }
+        
+        
+        /* Connects to the islands with a lower index that are not connected yet. */
+        void connect_peers()
+        {
+            for (unsigned k = 0; k < index; k++)
+            {
+                if (linked[k])
+                    continue;
+                
+                const auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                const auto address = socket_address(k);
+                
+                if (fd < 0)
+                    return;
+                
+                // a full backlog of the other island must not block the thread
+                nonblocking(fd);
+                
+                if (connect(fd, (const sockaddr*)&address, sizeof(address)) == 0)
+                    add_peer(fd, (int)k, false);
+                else if (errno == EINPROGRESS)
+                    add_peer(fd, (int)k, true);
+                else
+                {
+                    // not listening yet (or EAGAIN with a full backlog): retry later
+                    close(fd);
+                    continue;
+                }
+                
+                linked[k] = true;
+            }
+        }
+        
+        
+        /* Completes a connection in progress, which is retried later if it failed. */
+        void connected(Peer& p)
+        {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            
+            if (getsockopt(p.fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0)
+            {
+                close(p.fd);
+                p.fd = -1;
+                linked[p.island] = false;
+            }
+            else
+                p.connecting = false;
+        }
+        
+        
+        /* Accepts the connections of the islands with a higher index. */
+        void accept_peers()
+        {
+            int fd;
+            
+            while ((fd = accept(listener, nullptr, nullptr)) >= 0)
+                add_peer(fd, -1, false);
+        }
+        
+        
+        /* Adds a connection: a late island receives the last tour and the stop if any. */
+        void add_peer(int fd, int island, bool connecting)
+        {
+            nonblocking(fd);
+
+#ifdef SO_NOSIGPIPE
+            const int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+            
+            Peer p = { fd, string(), string(), island, connecting };
+            
+            {
+                lock_guard<mutex> lock(m);
+                p.out = last_tour;
+            }
+            
+            if (stop_signal)
+            {
+                Header header = { stop_message, 0, 0 };
+                p.out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            }
+            
+            peers.push_back(move(p));
+        }
+        
+        
+        /* Reads the available data of a connection. Returns false if it has to be closed. */
+        bool read_peer(Peer& p)
+        {
+            char buffer[65536];
+            ssize_t n;
+            
+            while ((n = read(p.fd, buffer, sizeof(buffer))) > 0)
+                p.in.append(buffer, n);
+            
+            // the messages sent before closing the connection are parsed anyway
+            const auto closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+            
+            // parse the complete messages
+            size_t offset = 0;
+            Header header;
+            
+            while (p.in.size() - offset >= sizeof(header))
+            {
+                memcpy(&header, p.in.data() + offset, sizeof(header));
+                
+                if (header.type == stop_message)
+                {
+                    stop_signal = true;
+                    offset += sizeof(header);
+                    continue;
+                }
+                
+                if (header.type != tour_message || header.nodes != nodes)
+                    return false;
+                
+                const auto size = sizeof(header) + nodes * sizeof(I);
+                
+                if (p.in.size() - offset < size)
+                    break;
+                
+                Chromosome<T, I> c(nodes);
+                memcpy(c.tour.data(), p.in.data() + offset + sizeof(header), nodes * sizeof(I));
+                c.cost = (cost_type<T>)header.cost;
+                offset += size;
+                
+                if (!TSP::permutation(c.tour, nodes))
+                    return false;
+                
+                update_best(header.cost);
+                
+                lock_guard<mutex> lock(m);
+                inbox.push_back(move(c));
+            }
+            
+            p.in.erase(0, offset);
+            return !closed;
+        }
+        
+        
+        /* Writes the pending data of a connection. Returns false if it has to be closed. */
+        bool write_peer(Peer& p)
+        {
+#ifdef MSG_NOSIGNAL
+            const int flags = MSG_NOSIGNAL;
+#else
+            const int flags = 0;
+#endif
+            
+            while (!p.out.empty())
+            {
+                const auto n = ::send(p.fd, p.out.data(), p.out.size(), flags);
+                
+                if (n < 0)
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+                
+                p.out.erase(0, n);
+            }
+            
+            return true;
+        }
+        
+        
+        bool outbox_empty()
+        {
+            lock_guard<mutex> lock(m);
+            return outbox.empty();
+        }
+        
+        
+        void update_best(double cost)
+        {
+            auto best = best_cost.load();
+            
+            while (cost < best && !best_cost.compare_exchange_weak(best, cost))
+                ;
+        }
+        
+        
+        /* Wakes up the background thread. */
+        void wake()
+        {
+            const char c = 0;
+            
+            // a full pipe means that the thread is already awake
+            if (write(wakeup[1], &c, 1) < 0)
+                return;
+        }
+        
+        
+        sockaddr_un socket_address(unsigned k) const
+        {
+            sockaddr_un address;
+            memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            
+            const auto name = path + "." + to_string(k);
+            
+            if (name.size() >= sizeof(address.sun_path))
+                throw invalid_argument(path);
+            
+            strcpy(address.sun_path, name.c_str());
+            return address;
+        }
+        
+        
+        static void nonblocking(int fd)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+        
+        
+        void close_all()
+        {
+            for (auto& p : peers)
+                close(p.fd);
+            
+            if (listener >= 0)
+                close(listener);
+            
+            close(wakeup[0]);
+            close(wakeup[1]);
+        }
+        
+        
+        
+        
+        // prefix of the socket files
+        const string path;
+        
+        // index of this island
+        const unsigned index;
+        
+        // number of islands
+        const unsigned count;
+        
+        // number of nodes of the tours
+        const size_t nodes;
+        
+        // whether the islands with a lower index have been connected
+        vector<bool> linked;
+        
+        // lowest cost sent or received
+        atomic<double> best_cost;
+        
+        // whether an island has stopped
+        atomic<bool> stop_signal;
+        
+        // whether the background thread has to exit
+        atomic<bool> quit;
+        
+        // messages queued by the solver
+        string outbox;
+        
+        // last tour message (sent to the islands that connect later)
+        string last_tour;
+        
+        // tours received from the other islands
+        vector<Chromosome<T, I>> inbox;
+        
+        mutex m;
+        
+        // connections with the other islands (used by the background thread only)
+        vector<Peer> peers;
+        
+        // listening socket
+        int listener;
+        
+        // pipe used to wake up the background thread
+        int wakeup[2];
+        
+        // background thread
+        thread worker;
+    };
+    
+    template<class T, class I>
+    constexpr uint32_t Island<T, I>::tour_message;
+    
+    template<class T, class I>
+    constexpr uint32_t Island<T, I>::stop_message;
+}
+
+
+#endif
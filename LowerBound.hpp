@@ -0,0 +1,342 @@
+#ifndef LOWER_BOUND_HPP
+#define LOWER_BOUND_HPP
+
+
+#include <vector>
+#include <utility>
+#include <queue>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <type_traits>
+using namespace std;
+
+
+namespace tsp
+{
+    /* Held-Karp lower bound computed on a background thread: the penalties of the nodes are
+     * optimized by subgradient ascent over the 1-trees of the graph of the nearest nodes, and
+     * the bound is evaluated over the complete graph (so that it is always a valid one). */
+    template<class T, class I = unsigned>
+    struct LowerBound
+    {
+        /* Starts the computation given an upper bound (the cost of a known tour). */
+        explicit LowerBound(const vector<vector<T>>& distances,
+                            const vector<vector<I>>& nearest,
+                            double upper, unsigned candidates = 10)
+        : distances(distances),
+        size(distances.size()),
+        upper(upper),
+        bound(0),
+        converged(false),
+        stop(false)
+        {
+            // symmetric graph of candidate edges
+            adjacency.resize(size);
+            const auto k = min<size_t>(candidates, size > 0 ? size - 1 : 0);
+            
+            for (unsigned i = 0; i < size; i++)
+            {
+                for (size_t n = 0; n < k; n++)
+                {
+                    const auto j = nearest[i][n];
+                    adjacency[i].push_back(j);
+                    adjacency[j].push_back(i);
+                }
+            }
+            
+            for (auto& list : adjacency)
+            {
+                sort(list.begin(), list.end());
+                list.erase(unique(list.begin(), list.end()), list.end());
+            }
+            
+            worker = thread(&LowerBound::run, this);
+        }
+        
+        
+        /* Stops the computation. */
+        ~LowerBound()
+        {
+            stop = true;
+            worker.join();
+        }
+        
+        
+        /* Gets the best lower bound computed so far. */
+        double value() const
+        {
+            return bound;
+        }
+        
+        
+        /* Whether the bound cannot be improved any further. */
+        bool finished() const
+        {
+            return converged;
+        }
+        
+        
+        /* Updates the cost of the best known tour (used to size the ascent steps). */
+        void update_upper(double cost)
+        {
+            upper = cost;
+        }
+    
+    
+    
+    
+    private:
+        
+        
+        /* Subgradient ascent. */
+        void run()
+        {
+            if (size < 3)
+            {
+                converged = true;
+                return;
+            }
+            
+            vector<double> pi(size, 0), best_pi(pi);
+            vector<int> degree(size), previous(size, 0);
+            auto best = -numeric_limits<double>::max();
+            auto evaluated = best;
+            
+            // the step is halved when the bound does not improve for a while
+            auto lambda = 1.0;
+            const auto period = max<unsigned>(50, unsigned(size / 10));
+            unsigned not_improving = 0, iteration = 0;
+            auto sparse = true;
+            
+            while (!stop && lambda > 1e-6)
+            {
+                auto value = one_tree(pi, degree, sparse);
+                
+                // the graph of the nearest nodes is not connected
+                if (value != value)
+                {
+                    sparse = false;
+                    continue;
+                }
+                
+                if (value > best)
+                {
+                    best = value;
+                    best_pi = pi;
+                    not_improving = 0;
+                }
+                else if (++not_improving == period)
+                {
+                    lambda /= 2;
+                    not_improving = 0;
+                }
+                
+                double norm = 0;
+                
+                for (unsigned i = 0; i < size; i++)
+                {
+                    // mix the subgradient with the previous one to smooth the ascent
+                    const auto g = 0.7 * (degree[i] - 2) + 0.3 * previous[i];
+                    norm += g * g;
+                }
+                
+                // the 1-tree is a tour: the bound is optimal
+                if (norm == 0)
+                    break;
+                
+                const auto step = lambda * max(upper.load() - best, 1e-6 * abs(best)) / norm;
+                
+                for (unsigned i = 0; i < size; i++)
+                {
+                    pi[i] += step * (0.7 * (degree[i] - 2) + 0.3 * previous[i]);
+                    previous[i] = degree[i] - 2;
+                }
+                
+                // evaluate the best penalties over the complete graph from time to time
+                if (++iteration % 20 == 0 && best > evaluated)
+                {
+                    evaluate(best_pi);
+                    evaluated = best;
+                }
+            }
+            
+            if (best > evaluated)
+                evaluate(best_pi);
+            
+            converged = !stop;
+        }
+        
+        
+        /* Evaluates the bound of the given penalties over the complete graph. */
+        void evaluate(const vector<double>& pi)
+        {
+            vector<int> degree(size);
+            auto value = one_tree(pi, degree, false);
+            
+            // the cost of a tour is integral
+            if (is_integral<T>::value)
+                value = ceil(value - 1e-9 * abs(value));
+            
+            if (value > bound)
+                bound = value;
+        }
+        
+        
+        /* Computes the value of the minimum 1-tree with the given penalties: a minimum spanning
+         * tree of the nodes but the first, plus the two shortest edges of the first node.
+         * Returns NaN if the candidate graph is not connected. */
+        double one_tree(const vector<double>& pi, vector<int>& degree, bool sparse) const
+        {
+            const auto none = numeric_limits<unsigned>::max();
+            const auto inf = numeric_limits<double>::max();
+            const auto weight = [this, &pi](unsigned i, unsigned j)
+                { return distances[i][j] + pi[i] + pi[j]; };
+            
+            vector<double> key(size, inf);
+            vector<unsigned> parent(size, none);
+            vector<bool> done(size, false);
+            fill(degree.begin(), degree.end(), 0);
+            
+            // the first node is not part of the spanning tree
+            done[0] = true;
+            key[1] = 0;
+            double total = 0;
+            size_t reached = 0;
+            
+            if (sparse)
+            {
+                // Prim's algorithm over the candidate edges
+                priority_queue<pair<double, unsigned>, vector<pair<double, unsigned>>,
+                    greater<pair<double, unsigned>>> queue;
+                queue.emplace(0, 1);
+                
+                while (!queue.empty())
+                {
+                    const auto u = queue.top().second;
+                    queue.pop();
+                    
+                    if (done[u])
+                        continue;
+                    
+                    add(u, key, parent, done, degree, total, reached);
+                    
+                    for (auto v : adjacency[u])
+                    {
+                        const auto w = weight(u, v);
+                        
+                        if (!done[v] && w < key[v])
+                        {
+                            key[v] = w;
+                            parent[v] = u;
+                            queue.emplace(w, v);
+                        }
+                    }
+                }
+                
+                if (reached != size - 1)
+                    return numeric_limits<double>::quiet_NaN();
+            }
+            else
+            {
+                // Prim's algorithm over the complete graph
+                for (size_t n = 1; n < size; n++)
+                {
+                    unsigned u = none;
+                    
+                    for (unsigned v = 1; v < size; v++)
+                    {
+                        if (!done[v] && (u == none || key[v] < key[u]))
+                            u = v;
+                    }
+                    
+                    add(u, key, parent, done, degree, total, reached);
+                    
+                    for (unsigned v = 1; v < size; v++)
+                    {
+                        const auto w = weight(u, v);
+                        
+                        if (!done[v] && w < key[v])
+                        {
+                            key[v] = w;
+                            parent[v] = u;
+                        }
+                    }
+                }
+            }
+            
+            // the two shortest edges of the first node
+            unsigned first = none, second = none;
+            
+            for (unsigned v = 1; v < size; v++)
+            {
+                if (first == none || weight(0, v) < weight(0, first))
+                {
+                    second = first;
+                    first = v;
+                }
+                else if (second == none || weight(0, v) < weight(0, second))
+                    second = v;
+            }
+            
+            total += weight(0, first) + weight(0, second);
+            degree[0] = 2;
+            degree[first]++;
+            degree[second]++;
+            
+            for (auto p : pi)
+                total -= 2 * p;
+            
+            return total;
+        }
+        
+        
+        /* Adds a node to the spanning tree. */
+        static void add(unsigned u, const vector<double>& key, const vector<unsigned>& parent,
+                        vector<bool>& done, vector<int>& degree, double& total, size_t& reached)
+        {
+            done[u] = true;
+            total += key[u];
+            reached++;
+            
+            if (parent[u] != numeric_limits<unsigned>::max())
+            {
+                degree[u]++;
+                degree[parent[u]]++;
+            }
+        }
+        
+        
+        
+        
+        // matrix of distances between nodes
+        const vector<vector<T>>& distances;
+        
+        // number of nodes
+        const size_t size;
+        
+        // lists of candidate nodes adjacent to each node
+        vector<vector<unsigned>> adjacency;
+        
+        // cost of the best known tour
+        atomic<double> upper;
+        
+        // best lower bound
+        atomic<double> bound;
+        
+        // whether the ascent is over
+        atomic<bool> converged;
+        
+        // whether the computation has to be interrupted
+        atomic<bool> stop;
+        
+        // background thread
+        thread worker;
+    };
+}
+
+
+#endif
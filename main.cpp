@@ -1,4 +1,5 @@
 #include "GTSP.hpp"
+#include "Decomposition.hpp"
 
 
 #include <iostream>
@@ -6,6 +7,12 @@
 #include <string>
 #include <chrono>
 #include <iomanip>
+#include <fstream>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <memory>
 using namespace std;
 using namespace chrono;
 
@@ -14,6 +21,9 @@ static long long timeout = 0;
 static long long elapsed;
 static decltype(system_clock::now()) start;
 
+// instances with more nodes are decomposed (their matrix of distances would not fit in memory)
+static const size_t max_flat_size = 10000;
+
 
 static bool stop()
 {
@@ -22,41 +32,161 @@ static bool stop()
 }
 
 
-int main(int argc, char* argv[])
-{    
-    if (argc < 3)
-    {
-        cerr << "gtsp <filename> <timeout [s]> [<best known>]" << endl;
-        return 1;
-    }
+/* Solves the instance with distances of type T and nodes indexed by I, and prints the results. */
+template<class T, class I>
+static void solve(const vector<pair<double, double>>& coordinates, int argc, char* argv[])
+{
+    const auto best_known = (argc >= 4 ? stoi(argv[3]) : 0);
+    Chromosome<T, I> best(0);
+    double bound = 0, islands_best = 0;
+    auto checkpoint_failed = false, bound_converged = false;
     
-    try
+    if (coordinates.size() > max_flat_size)
     {
-        timeout = stoi(argv[2]);
-        const auto best_known = (argc == 4 ? stoi(argv[3]) : 0);
+        // the decomposition does not support the options of a single population
+        if (argc >= 5 && string(argv[4]) != "-")
+            throw invalid_argument("checkpoint file (not supported above " + to_string(max_flat_size) + " nodes)");
+        
+        if (argc >= 6 && stod(argv[5]) != 0)
+            throw invalid_argument("target gap (not supported above " + to_string(max_flat_size) + " nodes)");
+        
+        if (argc >= 7)
+            throw invalid_argument("islands (not supported above " + to_string(max_flat_size) + " nodes)");
         
-        GTSP<int> gtsp(argv[1]);
+        // the nodes of the sub-problems are always indexed by 16 bits
+        Decomposition<T, uint16_t> decomposition(coordinates);
         
         start = system_clock::now();
-        const auto best = gtsp.solve(stop, best_known);
+        const auto result = decomposition.solve(timeout);
+        best = Chromosome<T, I>(vector<I>(result.tour.begin(), result.tour.end()), result.cost);
+        stop();
+    }
+    else
+    {
+        GTSP<T, I> gtsp(coordinates);
+        
+        if (argc >= 5 && string(argv[4]) != "-")
+        {
+            // resume from the last snapshot if any
+            if (ifstream(argv[4]).good())
+                gtsp.resume(argv[4]);
+            
+            gtsp.set_checkpoint(argv[4], 60);
+        }
+        
+        if (argc >= 6)
+            gtsp.set_target_gap(stod(argv[5]) / 100);
+        
+        // run as an island of an archipelago of processes
+        unique_ptr<Island<T, I>> island;
         
-        cout << "Best: " << best.cost << setprecision(2);
+        if (argc >= 9)
+        {
+            island.reset(new Island<T, I>(argv[6], stoi(argv[7]), stoi(argv[8]), coordinates.size()));
+            gtsp.set_island(island.get());
+        }
         
-        if (best_known < best.cost && best_known != 0)
-            cout << " " << (((double)best.cost - best_known) / best_known * 100) << "%";
+        // the first island that stops stops all the others
+        auto criteria = [&island] { return stop() || (island && island->stopped()); };
         
-        cout << endl;
-        cout << "Elapsed: " << elapsed << " [s]" << endl << endl;
+        start = system_clock::now();
+        best = gtsp.solve(criteria, best_known);
+        bound = gtsp.lower_bound();
+        bound_converged = gtsp.lower_bound_converged();
+        checkpoint_failed = gtsp.checkpoint_failed();
         
-        cout << "Best tour:" << endl << "{";
-        for (size_t i = 0; i < best.tour.size(); i++)
+        if (island)
         {
-            cout << best.tour[i];
-            
-            if (i != best.tour.size() - 1)
-                cout << ", ";
+            island->send(best);
+            island->stop();
+            islands_best = island->best();
         }
-        cout << "}" << endl;
+    }
+    
+    cout << "Best: " << best.cost << setprecision(2);
+    
+    if (best_known < best.cost && best_known != 0)
+        cout << " " << (((double)best.cost - best_known) / best_known * 100) << "%";
+    
+    cout << endl;
+    
+    if (bound > 0)
+        cout << "Lower bound: " << (long long)bound << " " << ((best.cost - bound) / bound * 100) << "%"
+             << (bound_converged ? " (converged)" : "") << endl;
+    
+    if (islands_best > 0)
+        cout << "Islands best: " << (long long)islands_best << endl;
+    
+    cout << "Elapsed: " << elapsed << " [s]" << endl << endl;
+    
+    cout << "Best tour:" << endl << "{";
+    for (size_t i = 0; i < best.tour.size(); i++)
+    {
+        cout << best.tour[i];
+        
+        if (i != best.tour.size() - 1)
+            cout << ", ";
+    }
+    cout << "}" << endl;
+    
+    // the result is printed anyway, but the run cannot be resumed
+    if (checkpoint_failed)
+        throw runtime_error("checkpoint file " + string(argv[4]) + " not written");
+}
+
+
+/* Selects the narrowest index type that fits the number of nodes. */
+template<class T>
+static void solve(const vector<pair<double, double>>& coordinates, int argc, char* argv[])
+{
+    if (coordinates.size() <= (size_t)numeric_limits<uint16_t>::max() + 1)
+        solve<T, uint16_t>(coordinates, argc, argv);
+    else
+        solve<T, unsigned>(coordinates, argc, argv);
+}
+
+
+/* Gets the length of the diagonal of the bounding box of the nodes (the maximum distance). */
+static double diagonal(const vector<pair<double, double>>& coordinates)
+{
+    auto xmin = numeric_limits<double>::max(), xmax = -xmin;
+    auto ymin = xmin, ymax = xmax;
+    
+    for (const auto& c : coordinates)
+    {
+        xmin = min(xmin, c.first);
+        xmax = max(xmax, c.first);
+        ymin = min(ymin, c.second);
+        ymax = max(ymax, c.second);
+    }
+    
+    return coordinates.empty() ? 0 : hypot(xmax - xmin, ymax - ymin);
+}
+
+
+int main(int argc, char* argv[])
+{    
+    if (argc < 3)
+    {
+        cerr << "gtsp <filename> <timeout [s]> [<best known>] [<checkpoint file>] [<target gap [%]>] "
+             "[<socket path> <island> <islands>]" << endl;
+        return 1;
+    }
+    
+    try
+    {
+        // the islands need all of their three arguments
+        if (argc > 6 && argc < 9)
+            throw invalid_argument("islands (<socket path> <island> <islands>)");
+        
+        timeout = stoi(argv[2]);
+        const auto coordinates = TSP::parse_tsplib(argv[1]);
+        
+        // the narrowest distances that fit the longest edge (16 bits halve the matrix)
+        if (round(diagonal(coordinates)) <= numeric_limits<uint16_t>::max())
+            solve<uint16_t>(coordinates, argc, argv);
+        else
+            solve<int>(coordinates, argc, argv);
     }
     catch (exception& e)
     {
@@ -66,4 +196,3 @@ int main(int argc, char* argv[])
     
 	return 0;
 }
-
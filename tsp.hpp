@@ -13,6 +13,7 @@
 #include <random>
 #include <chrono>
 #include <stdexcept>
+#include <type_traits>
 using namespace std;
 using namespace chrono;
 
@@ -20,6 +21,12 @@ using namespace chrono;
 namespace tsp
 {
     
+    /* Type of the cost of a tour whose edges have distances of type T
+     * (integral distances may be narrow, their sum needs to be wide). */
+    template<class T>
+    using cost_type = typename conditional<is_integral<T>::value, long long, T>::type;
+    
+    
     struct TSP
     {
         
@@ -97,10 +104,10 @@ namespace tsp
         
         
         /* http://comopt.ifi.uni-heidelberg.de/software/TSPLIB95/STSP.html */
-        template<class T>
-        static double cost(const vector<unsigned>& tour, const vector<vector<T>>& distances)
+        template<class T, class I>
+        static double cost(const vector<I>& tour, const vector<vector<T>>& distances)
         {
-            T dist = 0;
+            cost_type<T> dist = 0;
             const auto len = tour.size();
             
             for (size_t i = 0; i < len - 1; i++)
@@ -110,6 +117,27 @@ namespace tsp
         }
         
         
+        /* Whether the tour visits each of the 'size' nodes once. */
+        template<class I>
+        static bool permutation(const vector<I>& tour, size_t size)
+        {
+            if (tour.size() != size)
+                return false;
+            
+            vector<bool> visited(size, false);
+            
+            for (auto node : tour)
+            {
+                if (node >= size || visited[node])
+                    return false;
+                
+                visited[node] = true;
+            }
+            
+            return true;
+        }
+        
+        
         
     private:
         